@@ -11,16 +11,320 @@
  
 #include "BTreeIndex.h"
 #include "BTreeNode.h"
+#include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <sched.h>
 
 using namespace std;
 
+const double BTreeIndex::DEFAULT_FILL_FACTOR = 0.9;
+
+// # nonleaf nodes kept in memory by an open index
+static const int UPPER_NODES = BTreeIndex::UPPER_LEVEL_BUDGET / PageFile::PAGE_SIZE;
+
+// identifies page 0 of an index that records its format version
+static const int INDEX_MAGIC = 0x42545249; // "IRTB"
+
+// # levels an insert that fits in its leaf can descend. no tree of 2^31
+// entries is this high, as a split node keeps at least half its keys
+static const int MAX_HEIGHT = 32;
+
+// # times a count starts over when inserts run in between before it
+// holds off the inserts
+static const int COUNT_TRIES = 8;
+
+//
+// versioned latches. the version of a latch is odd while a writer holds
+// it and is advanced when the writer releases it. readers never write to
+// a latch: they note its version before reading a node and check
+// afterwards that it has not changed.
+//
+
+// wait until no writer holds the latch and return its version
+static unsigned latchRead(volatile unsigned& latch)
+{
+  unsigned version;
+  while ((version = latch) & 1) sched_yield();
+  __sync_synchronize();
+  return version;
+}
+
+// check that the latch still has the version returned by latchRead()
+static bool latchValidate(volatile unsigned& latch, unsigned version)
+{
+  __sync_synchronize();
+  return latch == version;
+}
+
+// take the latch if it still has the version returned by latchRead()
+static bool latchUpgrade(volatile unsigned& latch, unsigned version)
+{
+  return __sync_bool_compare_and_swap(&latch, version, version + 1);
+}
+
+// take the latch, waiting for the current writer if any
+static void latchLock(volatile unsigned& latch)
+{
+  while (!latchUpgrade(latch, latchRead(latch)));
+}
+
+// release the latch, announcing a new version
+static void latchUnlock(volatile unsigned& latch)
+{
+  __sync_fetch_and_add(&latch, 1);
+}
+
+// make an index entry
+static IndexEntry makeEntry(int key, const RecordId& rid)
+{
+  IndexEntry e;
+  e.key = key;
+  e.rid = rid;
+  return e;
+}
+
+// order index entries by key, breaking ties by RecordId
+static bool operator< (const IndexEntry& e1, const IndexEntry& e2)
+{
+  if (e1.key != e2.key) return e1.key < e2.key;
+  return e1.rid < e2.rid;
+}
+
+static bool operator< (const CoveringEntry& e1, const CoveringEntry& e2)
+{
+  if (e1.key != e2.key) return e1.key < e2.key;
+  return e1.rid < e2.rid;
+}
+
+// the packed value of a bulk loaded entry (NULL if the index is not covering)
+static const char* valueOf(const IndexEntry&) { return NULL; }
+static const char* valueOf(const CoveringEntry& entry) { return entry.value; }
+
+/*
+ * BTreeBuilder: builds a B+tree bottom-up from entries given in key order.
+ * Leaves are filled up to the fill factor and chained as they are
+ * completed, and each completed node is passed up to its parent level.
+ */
+class BTreeBuilder {
+ public:
+  BTreeBuilder(PageFile& pf, double fillFactor, int valueSize);
+  ~BTreeBuilder();
+
+  /// add the next entry in key order, with its packed value if the
+  /// tree is covering
+  RC add(int key, const RecordId& rid, const char* value);
+
+  /// add the next leaf in key order, for a tree built on existing leaves.
+  /// it cannot be mixed with add()
+  RC addLeaf(PageId pid, int firstKey, int entries);
+
+  /// write the nodes still in memory and return the root and height
+  RC finish(PageId& rootPid, int& treeHeight);
+
+ private:
+  /// a nonleaf level under construction
+  struct Level {
+    BTNonLeafNode* node;       // the node being filled (NULL if < 2 children)
+    PageId         firstChild; // the first child of the node (-1 if none)
+    int            firstKey;   // the smallest key under the node
+    int            firstEntries; // # leaf entries under the first child
+  };
+
+  /// add a completed child node with the given # leaf entries to the
+  /// nonleaf level
+  RC addChild(unsigned level, int key, PageId pid, int entries);
+
+  /// write the nonleaf node of the level and pass it to the level above
+  RC flushLevel(unsigned level);
+
+  PageFile&     pf;
+  int           valueSize;    // # value bytes of a leaf entry
+  int           leafFill;     // # entries per leaf
+  int           nonLeafFill;  // # keys per nonleaf node
+  PageId        nextPid;      // the next unused page
+  BTLeafNode*   leaf;         // the leaf being filled (NULL before the first entry)
+  PageId        leafPid;      // the page of the leaf being filled
+  int           leafFirstKey; // the smallest key in the leaf
+  vector<Level> levels;       // levels[0] is the parent level of the leaves
+};
+
+BTreeBuilder::BTreeBuilder(PageFile& pf, double fillFactor, int valueSize)
+: pf(pf), valueSize(valueSize), nextPid(pf.endPid()), leaf(NULL), leafPid(-1),
+  leafFirstKey(0)
+{
+  leafFill = (int) (BTLeafNode::entriesPerPage(valueSize) * fillFactor);
+  nonLeafFill = (int) (BTNonLeafNode::KEYS_PER_PAGE * fillFactor);
+  if (leafFill < 1) leafFill = 1;
+  if (nonLeafFill < 1) nonLeafFill = 1;
+}
+
+BTreeBuilder::~BTreeBuilder()
+{
+  delete leaf;
+  for (unsigned i = 0; i < levels.size(); i++)
+    delete levels[i].node;
+}
+
+RC BTreeBuilder::add(int key, const RecordId& rid, const char* value)
+{
+  RC rc;
+
+  if (leaf != NULL && leaf->getKeyCount() == leafFill) {
+    // the leaf is full. chain it to a new leaf and pass it up.
+    PageId next = nextPid++;
+    leaf->setNextNodePtr(next);
+    if ((rc = leaf->write(leafPid, pf)) < 0)
+      return rc;
+    if ((rc = addChild(0, leafFirstKey, leafPid, leaf->getKeyCount())) < 0)
+      return rc;
+
+    delete leaf;
+    leaf = NULL;
+    leafPid = next;
+  }
+
+  if (leaf == NULL) {
+    leaf = new BTLeafNode(valueSize);
+    if (leafPid < 0) leafPid = nextPid++;
+    leafFirstKey = key;
+  }
+  return leaf->insert(key, rid, value);
+}
+
+RC BTreeBuilder::addLeaf(PageId pid, int firstKey, int entries)
+{
+  return addChild(0, firstKey, pid, entries);
+}
+
+RC BTreeBuilder::addChild(unsigned level, int key, PageId pid, int entries)
+{
+  RC rc;
+
+  if (level == levels.size()) {
+    Level l = { NULL, -1, 0, 0 };
+    levels.push_back(l);
+  }
+
+  Level& l = levels[level];
+  if (l.firstChild < 0) {
+    l.firstChild = pid;
+    l.firstKey = key;
+    l.firstEntries = entries;
+    return 0;
+  }
+  if (l.node == NULL) {
+    l.node = new BTNonLeafNode;
+    l.node->initializeRoot(l.firstChild, l.firstEntries, key, pid, entries);
+    return 0;
+  }
+  if (l.node->getKeyCount() < nonLeafFill)
+    return l.node->insert(key, pid, entries);
+
+  // the node is full. pass it up and start a new node with the child.
+  if ((rc = flushLevel(level)) < 0)
+    return rc;
+
+  // levels may have been reallocated by flushLevel()
+  levels[level].firstChild = pid;
+  levels[level].firstKey = key;
+  levels[level].firstEntries = entries;
+  return 0;
+}
+
+RC BTreeBuilder::flushLevel(unsigned level)
+{
+  RC     rc;
+  PageId pid = nextPid++;
+  int    firstKey = levels[level].firstKey;
+
+  if (levels[level].node == NULL) {
+    // a node with a single child and no key
+    levels[level].node = new BTNonLeafNode;
+    levels[level].node->splitFromSibling(0, NULL, &levels[level].firstChild,
+                                         &levels[level].firstEntries);
+  }
+  if ((rc = levels[level].node->write(pid, pf)) < 0)
+    return rc;
+
+  int entries = levels[level].node->getEntryCount();
+  delete levels[level].node;
+  levels[level].node = NULL;
+  levels[level].firstChild = -1;
+
+  return addChild(level + 1, firstKey, pid, entries);
+}
+
+RC BTreeBuilder::finish(PageId& rootPid, int& treeHeight)
+{
+  RC rc;
+
+  if (leaf != NULL) {
+    // the last leaf has no next sibling
+    leaf->setNextNodePtr(0);
+    if ((rc = leaf->write(leafPid, pf)) < 0)
+      return rc;
+    if ((rc = addChild(0, leafFirstKey, leafPid, leaf->getKeyCount())) < 0)
+      return rc;
+  }
+
+  // nothing was added. the tree stays empty.
+  if (levels.empty()) {
+    rootPid = -1;
+    treeHeight = 0;
+    return 0;
+  }
+
+  // complete the levels bottom-up. the first level left with a single
+  // child and nothing above it holds the root.
+  for (unsigned level = 0; ; level++) {
+    if (level == levels.size() - 1 && levels[level].node == NULL) {
+      rootPid = levels[level].firstChild;
+      treeHeight = level + 1;
+      return 0;
+    }
+    if ((rc = flushLevel(level)) < 0)
+      return rc;
+  }
+}
+
 /*
  * BTreeIndex constructor
  */
 BTreeIndex::BTreeIndex()
-: rootPid(-1), treeHeight(0) {}
+: fileMode('r'), rootPid(-1), treeHeight(0), valueSize(0), rootLatch(0), upperCount(0),
+  upperLevels(0), insertsBegun(0), insertsDone(0), bulkLoading(false), bulkFill(DEFAULT_FILL_FACTOR),
+  bulkEntries(SORT_BUFFER_ENTRIES),
+  bulkCovering(SORT_BUFFER_ENTRIES * sizeof(IndexEntry) / sizeof(CoveringEntry))
+{
+  for (int i = 0; i < LATCH_COUNT; i++) nodeLatches[i] = 0;
+
+  // a split waiting for splitLock goes before inserts that come later
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&splitLock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  pthread_mutex_init(&upperMutex, NULL);
+
+  UpperNode empty = { -1, NULL };
+  upperNodes.assign(2 * UPPER_NODES, empty);
+
+  // keep as many levels as fit the budget even when all nodes are full
+  long levelNodes = 1, nodes = 1;
+  while (nodes <= UPPER_NODES) {
+    upperLevels++;
+    levelNodes *= BTNonLeafNode::KEYS_PER_PAGE + 1;
+    nodes += levelNodes;
+  }
+}
+
+BTreeIndex::~BTreeIndex()
+{
+  clearUpperNodes();
+  pthread_rwlock_destroy(&splitLock);
+  pthread_mutex_destroy(&upperMutex);
+}
 
 /*
  * Open the index file in read or write mode.
@@ -29,28 +333,64 @@ BTreeIndex::BTreeIndex()
  * @param mode[IN] 'r' for read, 'w' for write
  * @return error code. 0 if no error
  */
-RC BTreeIndex::open(const string& indexname, char mode)
+RC BTreeIndex::open(const string& indexname, char mode, bool covering)
 {
   RC rc;
   if ((rc = pf.open(indexname, mode)) < 0)
     return rc;
+  fileMode = mode;
+  clearUpperNodes();
+  pendingEntries.clear();
 
-  char buffer[PageFile::PAGE_SIZE];
-  
   if (pf.endPid() == 0) {
-    memcpy(buffer, &rootPid, sizeof(PageId));
-    memcpy(buffer + sizeof(PageId), &treeHeight, sizeof(int));
-    
-    if ((rc = pf.write(0, buffer)) < 0)
+    if (mode == 'r' || mode == 'R') { // nothing to read from an empty index
+      pf.close();
+      return RC_INVALID_FILE_FORMAT;
+    }
+
+    rootPid = -1;
+    treeHeight = 0;
+    valueSize = covering ? INDEX_VALUE_SIZE : 0;
+    if ((rc = writeMetadata()) < 0)
       return rc;
   }
   else {
+    char buffer[PageFile::PAGE_SIZE];
+    int  magic, version;
+
     if ((rc = pf.read(0, buffer)) < 0)
       return rc;
     
     memcpy(&rootPid, buffer, sizeof(PageId));
     memcpy(&treeHeight, buffer + sizeof(PageId), sizeof(int));
+    memcpy(&magic, buffer + sizeof(PageId) + sizeof(int), sizeof(int));
+    memcpy(&version, buffer + sizeof(PageId) + sizeof(int)*2, sizeof(int));
+    memcpy(&valueSize, buffer + sizeof(PageId) + sizeof(int)*3, sizeof(int));
+
+    // an index without the magic number predates format versions and
+    // covering indexes
+    if (magic != INDEX_MAGIC) {
+      version = 1;
+      valueSize = 0;
+    }
+    if (valueSize < 0 || valueSize > INDEX_VALUE_SIZE) {
+      pf.close();
+      return RC_INVALID_FILE_FORMAT;
+    }
+
+    if (version != FORMAT_VERSION) {
+      // an old index is converted in place when it is opened for writing
+      if (version > FORMAT_VERSION || mode == 'r' || mode == 'R' ||
+          (rc = convertFormat(version)) < 0 || (rc = writeMetadata()) < 0) {
+        pf.close();
+        return rc < 0 ? rc : RC_INVALID_FILE_FORMAT;
+      }
+    }
   }
+
+  // lookups jump around the index file
+  pf.advise(PageFile::ACCESS_RANDOM);
+  growPending();
   
   return 0;
 }
@@ -61,16 +401,118 @@ RC BTreeIndex::open(const string& indexname, char mode)
  */
 RC BTreeIndex::close()
 {
-  char buffer[PageFile::PAGE_SIZE];
-  memcpy(buffer, &rootPid, sizeof(PageId));
-  memcpy(buffer + sizeof(PageId), &treeHeight, sizeof(int));
-  
+  abortBulkLoad();
+
+  // the metadata can only have changed under 'w' mode
+  if (fileMode == 'r' || fileMode == 'R') {
+    clearUpperNodes();
+    return pf.close();
+  }
+
+  // move the entries still pending into the counts of the nodes. this
+  // reads every nonleaf node, so it is done only if some are pending
   RC rc;
-  if ((rc = pf.write(0, buffer)) < 0)
+  if (treeHeight > 1 && count(pendingEntries.begin(), pendingEntries.end(), 0) != (long) pendingEntries.size() &&
+      (rc = flushPending(rootPid, 1)) < 0)
+    return rc;
+  clearUpperNodes();
+  if ((rc = writeMetadata()) < 0)
     return rc;
   return pf.close();
 }
 
+/*
+ * Write rootPid, treeHeight, the format version and valueSize to page 0.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::writeMetadata()
+{
+  char buffer[PageFile::PAGE_SIZE];
+  int  magic = INDEX_MAGIC, version = FORMAT_VERSION;
+
+  memset(buffer, 0, PageFile::PAGE_SIZE);
+  memcpy(buffer, &rootPid, sizeof(PageId));
+  memcpy(buffer + sizeof(PageId), &treeHeight, sizeof(int));
+  memcpy(buffer + sizeof(PageId) + sizeof(int), &magic, sizeof(int));
+  memcpy(buffer + sizeof(PageId) + sizeof(int)*2, &version, sizeof(int));
+  memcpy(buffer + sizeof(PageId) + sizeof(int)*3, &valueSize, sizeof(int));
+
+  return pf.write(0, buffer);
+}
+
+/*
+ * Convert an index in an older format to the current format.
+ * The leaves keep their pages, and version 1 leaves are rewritten in the
+ * current layout. Older nonleaf nodes hold more keys than a node with
+ * entry counts has room for, so the nonleaf levels are built again on
+ * top of the leaves and the old nonleaf pages are left unused.
+ * Version 1 nodes interleave their entries: a leaf stores
+ * [count][(rid, key) ...][next pid] and a nonleaf node stores
+ * [count][pid][(key, pid) ...]. A version 2 nonleaf node stores
+ * [count][keys][pids] with room for V2_NONLEAF_KEYS keys.
+ * @param version[IN] the format version of the index
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::convertFormat(int version)
+{
+  const int V2_NONLEAF_KEYS = 127;
+
+  RC     rc;
+  char   page[PageFile::PAGE_SIZE];
+  PageId pid = rootPid;
+  BTreeBuilder builder(pf, DEFAULT_FILL_FACTOR, valueSize);
+
+  if (treeHeight == 0)
+    return 0;
+
+  // descend along the first child pointers to the leftmost leaf
+  int firstChild = (version == 1) ? sizeof(int) : sizeof(int) + V2_NONLEAF_KEYS * sizeof(int);
+  for (int level = 1; level < treeHeight; level++) {
+    if ((rc = pf.read(pid, page)) < 0)
+      return rc;
+    memcpy(&pid, page + firstChild, sizeof(PageId));
+  }
+
+  // pass the leaves to the builder in order
+  while (pid > 0) {
+    int    count, firstKey;
+    PageId next;
+
+    if ((rc = pf.read(pid, page)) < 0)
+      return rc;
+    memcpy(&count, page, sizeof(int));
+    memcpy(&next, page + PageFile::PAGE_SIZE - sizeof(PageId), sizeof(PageId));
+    if (count < 0 || count > BTLeafNode::ENTRIES_PER_PAGE)
+      return RC_INVALID_FILE_FORMAT;
+
+    if (version == 1) {
+      const int entrySize = sizeof(RecordId) + sizeof(int);
+      int       keys[BTLeafNode::ENTRIES_PER_PAGE];
+      RecordId  rids[BTLeafNode::ENTRIES_PER_PAGE];
+      BTLeafNode node;
+
+      for (int i = 0; i < count; i++) {
+        memcpy(&rids[i], page + sizeof(int) + i*entrySize, sizeof(RecordId));
+        memcpy(&keys[i], page + sizeof(int) + i*entrySize + sizeof(RecordId), sizeof(int));
+      }
+      node.splitFromSibling(count, keys, rids);
+      node.setNextNodePtr(next);
+      if ((rc = node.write(pid, pf)) < 0)
+        return rc;
+      firstKey = keys[0];
+    }
+    else
+      memcpy(&firstKey, page + sizeof(int), sizeof(int));
+
+    // an empty leaf stays in the chain but has no entry to route to
+    if (count > 0 && (rc = builder.addLeaf(pid, firstKey, count)) < 0)
+      return rc;
+    pid = next;
+  }
+
+  return builder.finish(rootPid, treeHeight);
+}
+
 /*
  * Insert (key, RecordId) pair to the index.
  * @param key[IN] the key for the value inserted into the index
@@ -79,55 +521,139 @@ RC BTreeIndex::close()
  */
 RC BTreeIndex::insert(int key, const RecordId& rid)
 {
-  RC rc;
-  
+  return insertEntry(makeEntry(key, rid), NULL);
+}
+
+/*
+ * Insert (key, RecordId) pair to the index, together with the value
+ * of the record if the index is covering.
+ * @param key[IN] the key for the value inserted into the index
+ * @param rid[IN] the RecordId for the record being inserted into the index
+ * @param value[IN] the value of the record
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::insert(int key, const RecordId& rid, const string& value)
+{
+  char packed[INDEX_VALUE_SIZE];
+
+  if (valueSize == 0)
+    return insertEntry(makeEntry(key, rid), NULL);
+  packValue(value, packed);
+  return insertEntry(makeEntry(key, rid), packed);
+}
+
+RC BTreeIndex::insertEntry(const IndexEntry& entry, const char* value)
+{
+  RC     rc;
+  PageId pid;
+
+  // most inserts fit in their leaf and go on side by side
+  pthread_rwlock_rdlock(&splitLock);
+  rc = insertLeaf(entry, value);
+  pthread_rwlock_unlock(&splitLock);
+  if (rc != RC_NODE_FULL)
+    return rc;
+
+  // the others split nodes, with the tree to themselves. lookups go on
+  // meanwhile
+  pthread_rwlock_wrlock(&splitLock);
+
   if (!treeHeight) { // Tree is empty
-    BTLeafNode node;
-    node.insert(key, rid);
-    rootPid = pf.endPid();
-    
-    if ((rc = node.write(rootPid, pf)) < 0)
-      return rc;
-    treeHeight = 1;
+    BTLeafNode node(valueSize);
+    node.insert(entry.key, entry.rid, value);
+
+    latchForWrite(rootLatch);
+    pid = pf.endPid();
+    latchForWrite(latchOf(pid));
+    if ((rc = node.write(pid, pf)) == 0) {
+      rootPid = pid;
+      treeHeight = 1;
+    }
   }
   else {
     int    keyUp = -1;     // The key to be added to parent node
     PageId newNodeId = -1; // The new pageId after splitting
-    if ((rc = insertHelper(key, rid, rootPid, 1, keyUp, newNodeId)) < 0)
-      return rc;
+    int    newEntries = 0; // # entries under the new node
+    rc = insertHelper(entry, value, rootPid, 1, keyUp, newNodeId, newEntries);
     
-    if (newNodeId != -1) {
+    int rootEntries;
+    if (rc == 0 && newNodeId != -1 && (rc = countEntries(rootPid, 1, rootEntries)) == 0) {
       BTNonLeafNode newRoot;
-      newRoot.initializeRoot(rootPid, keyUp, newNodeId);
+      newRoot.initializeRoot(rootPid, rootEntries, keyUp, newNodeId, newEntries);
       
-      rootPid = pf.endPid();
-      if ((rc = newRoot.write(rootPid, pf)) < 0)
-        return rc;
-      treeHeight++;
+      latchForWrite(rootLatch);
+      pid = pf.endPid();
+      latchForWrite(latchOf(pid));
+      if ((rc = writeNonLeaf(pid, 1, newRoot)) == 0) {
+        rootPid = pid;
+        treeHeight++;
+      }
     }
   }
-  return 0;
+
+  growPending();
+  unlatchWrites();
+  pthread_rwlock_unlock(&splitLock);
+  return rc;
 }
 
-RC BTreeIndex::insertHelper(int key, const RecordId& rid, PageId nodeId, int level, int& keyUp, PageId& newNodeId) {
+RC BTreeIndex::insertLeaf(const IndexEntry& entry, const char* value)
+{
+  BTNonLeafNode node;
+  BTLeafNode    leaf(valueSize);
+  PageId        path[MAX_HEIGHT];
+  RC            rc;
+
+  if (treeHeight == 0 || treeHeight > MAX_HEIGHT)
+    return RC_NODE_FULL;
+
+  // no nonleaf node changes while splitLock is held shared, so the path
+  // is found without checking the latches
+  path[0] = rootPid;
+  for (int level = 1; level < treeHeight; level++) {
+    if ((rc = readNonLeaf(path[level - 1], level, node)) < 0)
+      return rc;
+    node.locateChildPtr(entry.key, path[level]);
+  }
+
+  PageId pid = path[treeHeight - 1];
+  __sync_fetch_and_add(&insertsBegun, 1);
+  latchLock(latchOf(pid));
+  if ((rc = leaf.read(pid, pf)) == 0 && (rc = leaf.insert(entry.key, entry.rid, value)) == 0)
+    rc = leaf.write(pid, pf);
+  latchUnlock(latchOf(pid));
+
+  // the counts kept in the nodes above the leaf are left as they are
+  if (rc == 0) {
+    for (int level = 1; level < treeHeight; level++)
+      __sync_fetch_and_add(&pendingEntries[path[level]], 1);
+  }
+  __sync_fetch_and_add(&insertsDone, 1);
+  return rc;
+}
+
+RC BTreeIndex::insertHelper(const IndexEntry& entry, const char* value, PageId nodeId, int level, int& keyUp, PageId& newNodeId, int& newEntries) {
   if (level < 0)
     return -1;
 
   RC rc;
   
   if (level == treeHeight) { // Reaching the leaf node
-    BTLeafNode node;
+    BTLeafNode node(valueSize);
+    latchForWrite(latchOf(nodeId));
     if ((rc = node.read(nodeId, pf)) < 0)
       return rc;
 
-    if (node.insert(key, rid) == RC_NODE_FULL) {
-      BTLeafNode sibling;
-      if ((rc = node.insertAndSplit(key, rid, sibling, keyUp)) < 0)
+    if (node.insert(entry.key, entry.rid, value) == RC_NODE_FULL) {
+      BTLeafNode sibling(valueSize);
+      if ((rc = node.insertAndSplit(entry.key, entry.rid, sibling, keyUp, value)) < 0)
         return rc;
 
       newNodeId = pf.endPid();
+      newEntries = sibling.getKeyCount();
       sibling.setNextNodePtr(node.getNextNodePtr());
       node.setNextNodePtr(newNodeId);
+      latchForWrite(latchOf(newNodeId));
       if ((rc = sibling.write(newNodeId, pf)) < 0)
         return rc;
     }
@@ -136,38 +662,227 @@ RC BTreeIndex::insertHelper(int key, const RecordId& rid, PageId nodeId, int lev
       return rc;
   }
   else { // This is a nonleaf node
+    // only splits change nonleaf nodes, so the node cannot change here
     BTNonLeafNode node;
-    if ((rc = node.read(nodeId, pf)) < 0)
+    if ((rc = readNonLeaf(nodeId, level, node)) < 0)
       return rc;
+    addUpperNode(nodeId, level, node);
 
+    int    eid;
     PageId childId;
-    node.locateChildPtr(key, childId);
-    if ((rc = insertHelper(key, rid, childId, level + 1, keyUp, newNodeId)) < 0)
+    node.locate(entry.key, eid);
+    node.locateChildPtr(entry.key, childId);
+    if ((rc = insertHelper(entry, value, childId, level + 1, keyUp, newNodeId, newEntries)) < 0)
       return rc;
 
-    if (newNodeId != -1) { // split in the child node
-      if (node.insert(keyUp, newNodeId) == RC_NODE_FULL) {
-        BTNonLeafNode sibling;
-        if ((rc = node.insertAndSplit(keyUp, newNodeId, sibling, keyUp)) < 0)
-          return rc;
+    // a child that was not split has one more entry pending
+    if (newNodeId == -1) {
+      pendingEntries[childId]++;
+      return 0;
+    }
 
-        newNodeId = pf.endPid(); // update the ID
-        if ((rc = sibling.write(newNodeId, pf)) < 0)
-          return rc;
-      }
-      else { // Clean up if no split
-        keyUp = -1;
-        newNodeId = -1;
-      }
-      
-      if ((rc = node.write(nodeId, pf)) < 0)
+    // a child that was split has the new entry and those pending, minus
+    // those moved to the new sibling
+    int childEntries = node.getChildEntries(eid) + pendingEntries[childId] + 1;
+    pendingEntries[childId] = 0;
+    node.setChildEntries(eid, childEntries - newEntries);
+    if (node.insert(keyUp, newNodeId, newEntries) == RC_NODE_FULL) {
+      BTNonLeafNode sibling;
+      if ((rc = node.insertAndSplit(keyUp, newNodeId, newEntries, sibling, keyUp)) < 0)
+        return rc;
+
+      newNodeId = pf.endPid(); // update the ID
+      newEntries = entriesUnder(sibling);
+      latchForWrite(latchOf(newNodeId));
+      if ((rc = writeNonLeaf(newNodeId, level, sibling)) < 0)
         return rc;
     }
+    else { // Clean up if no split
+      keyUp = -1;
+      newNodeId = -1;
+      newEntries = 0;
+    }
+      
+    latchForWrite(latchOf(nodeId));
+    if ((rc = writeNonLeaf(nodeId, level, node)) < 0)
+      return rc;
   }
   
   return 0;
 }
 
+RC BTreeIndex::countEntries(PageId pid, int level, int& entries) const
+{
+  RC rc;
+
+  if (level == treeHeight) {
+    BTLeafNode leaf(valueSize);
+    if ((rc = leaf.read(pid, pf)) < 0)
+      return rc;
+    entries = leaf.getKeyCount();
+  }
+  else {
+    BTNonLeafNode node;
+    if ((rc = readNonLeaf(pid, level, node)) < 0)
+      return rc;
+    entries = entriesUnder(node);
+  }
+  return 0;
+}
+
+int BTreeIndex::entriesUnder(BTNonLeafNode& node) const
+{
+  int entries = node.getEntryCount();
+
+  for (int i = 0; i <= node.getKeyCount(); i++)
+    entries += pendingOf(node.getChildPtr(i));
+  return entries;
+}
+
+int BTreeIndex::pendingOf(PageId pid) const
+{
+  if (pid < 0 || pid >= (PageId) pendingEntries.size())
+    return 0;
+  return pendingEntries[pid];
+}
+
+void BTreeIndex::growPending()
+{
+  // leave room for the nodes added later, so that the vector is seldom
+  // moved
+  if ((PageId) pendingEntries.size() < pf.endPid())
+    pendingEntries.resize(pf.endPid() * 2, 0);
+}
+
+RC BTreeIndex::flushPending(PageId pid, int level)
+{
+  BTNonLeafNode node;
+  RC            rc;
+  bool          changed = false;
+
+  if ((rc = readNonLeaf(pid, level, node)) < 0)
+    return rc;
+
+  for (int i = 0; i <= node.getKeyCount(); i++) {
+    PageId child = node.getChildPtr(i);
+    if (level + 1 < treeHeight && (rc = flushPending(child, level + 1)) < 0)
+      return rc;
+    if (pendingOf(child) != 0) {
+      node.setChildEntries(i, node.getChildEntries(i) + pendingEntries[child]);
+      pendingEntries[child] = 0;
+      changed = true;
+    }
+  }
+  return changed ? writeNonLeaf(pid, level, node) : 0;
+}
+
+/*
+ * Start building an empty index bottom-up.
+ * @param fillFactor[IN] the fraction of every node to fill
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::beginBulkLoad(double fillFactor)
+{
+  if (treeHeight != 0 || bulkLoading)
+    return RC_INVALID_FILE_FORMAT;
+  if (fillFactor <= 0 || fillFactor > 1)
+    fillFactor = DEFAULT_FILL_FACTOR;
+
+  bulkLoading = true;
+  bulkFill = fillFactor;
+  bulkEntries.clear();
+  bulkCovering.clear();
+  return 0;
+}
+
+/*
+ * Add a (key, RecordId) pair to the index being bulk loaded.
+ * @param key[IN] the key for the value inserted into the index
+ * @param rid[IN] the RecordId for the record being inserted into the index
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::bulkInsert(int key, const RecordId& rid)
+{
+  if (!bulkLoading)
+    return RC_INVALID_CURSOR;
+  if (valueSize == 0)
+    return bulkEntries.add(makeEntry(key, rid));
+
+  CoveringEntry e;
+  e.key = key;
+  e.rid = rid;
+  memset(e.value, 0, INDEX_VALUE_SIZE);
+  return bulkCovering.add(e);
+}
+
+/*
+ * Add a (key, RecordId) pair to the index being bulk loaded, together
+ * with the value of the record if the index is covering.
+ * @param key[IN] the key for the value inserted into the index
+ * @param rid[IN] the RecordId for the record being inserted into the index
+ * @param value[IN] the value of the record
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::bulkInsert(int key, const RecordId& rid, const string& value)
+{
+  if (!bulkLoading)
+    return RC_INVALID_CURSOR;
+  if (valueSize == 0)
+    return bulkEntries.add(makeEntry(key, rid));
+
+  CoveringEntry e;
+  e.key = key;
+  e.rid = rid;
+  packValue(value, e.value);
+  return bulkCovering.add(e);
+}
+
+void BTreeIndex::abortBulkLoad()
+{
+  bulkEntries.clear();
+  bulkCovering.clear();
+  bulkLoading = false;
+}
+
+// pass the sorted entries to the builder
+template <class Entry>
+static RC buildFrom(ExternalSort<Entry>& entries, BTreeBuilder& builder)
+{
+  RC    rc;
+  Entry e;
+
+  while ((rc = entries.next(e)) == 0) {
+    if ((rc = builder.add(e.key, e.rid, valueOf(e))) < 0)
+      return rc;
+  }
+  return (rc == RC_END_OF_FILE) ? 0 : rc;
+}
+
+/*
+ * Build the index from the pairs added by bulkInsert().
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::endBulkLoad()
+{
+  RC           rc;
+  BTreeBuilder builder(pf, bulkFill, valueSize);
+
+  if (!bulkLoading)
+    return RC_INVALID_CURSOR;
+
+  if (valueSize == 0)
+    rc = buildFrom(bulkEntries, builder);
+  else
+    rc = buildFrom(bulkCovering, builder);
+
+  if (rc == 0)
+    rc = builder.finish(rootPid, treeHeight);
+  growPending();
+
+  abortBulkLoad();
+  return rc;
+}
+
 /**
  * Run the standard B+Tree key search algorithm and identify the
  * leaf node where searchKey may exist. If an index entry with
@@ -188,29 +903,270 @@ RC BTreeIndex::insertHelper(int key, const RecordId& rid, PageId nodeId, int lev
  */
 RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
 {
-  BTLeafNode    leafNode;
-  BTNonLeafNode nonLeafNode;
+  RC       rc;
+  PageId   pid;
+  unsigned version;
+  int      eid;
   
-  RC     rc;
-  PageId pid = rootPid;
-  int    eid;
-  
-  for (int i = 1; i < treeHeight; i++) {
-    if ((rc = nonLeafNode.read(pid, pf)) < 0)
+  do {
+    if ((rc = findLeaf(searchKey, pid, version)) < 0)
       return rc;
 
-    nonLeafNode.locateChildPtr(searchKey, pid);
-  }
+    BTLeafNode leafNode(valueSize);
+    if ((rc = leafNode.read(pid, pf)) == 0)
+      rc = leafNode.locate(searchKey, eid);
+  } while (!latchValidate(latchOf(pid), version));
   
-  if ((rc = leafNode.read(pid, pf)) < 0)
+  if (rc < 0 && rc != RC_NO_SUCH_RECORD)
     return rc;
-  
-  rc = leafNode.locate(searchKey, eid);
   cursor.pid = pid;
   cursor.eid = eid;
   return rc;
 }
 
+RC BTreeIndex::findLeaf(int searchKey, PageId& pid, unsigned& version) const
+{
+  BTNonLeafNode nonLeafNode;
+  RC            rc;
+  int           level, height;
+
+  // descend holding no latch. the version of the parent is checked after
+  // the child pointer is read from it, and an inconsistent read starts over
+  for (;;) {
+    unsigned rootVersion = latchRead(rootLatch);
+    pid = rootPid;
+    height = treeHeight;
+    version = latchRead(latchOf(pid));
+    if (!latchValidate(rootLatch, rootVersion))
+      continue;
+    if (height == 0)
+      return RC_END_OF_TREE;
+
+    for (level = 1; level < height; level++) {
+      PageId   child;
+      unsigned childVersion;
+
+      if ((rc = readNonLeaf(pid, level, nonLeafNode)) < 0) {
+        if (latchValidate(latchOf(pid), version))
+          return rc;
+        break;
+      }
+      nonLeafNode.locateChildPtr(searchKey, child);
+      childVersion = latchRead(latchOf(child));
+
+      if (!latchValidate(latchOf(pid), version))
+        break;
+      pid = child;
+      version = childVersion;
+    }
+    if (level == height)
+      return 0;
+  }
+}
+
+/*
+ * Count the entries whose key lies in [lo, hi].
+ * @param lo[IN] the smallest key to count
+ * @param hi[IN] the largest key to count
+ * @param count[OUT] the number of entries
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::countRange(int lo, int hi, int& count) const
+{
+  RC  rc;
+  int below, upTo;
+
+  count = 0;
+  if (lo > hi)
+    return 0;
+
+  // the two descents must count a single state of the tree. splits are
+  // held off, and the count starts over if an insert ran in between. if
+  // inserts keep running, they are held off too
+  for (int tries = 0; ; tries++) {
+    if (tries < COUNT_TRIES)
+      pthread_rwlock_rdlock(&splitLock);
+    else
+      pthread_rwlock_wrlock(&splitLock);
+
+    unsigned done = insertsDone;
+    __sync_synchronize();
+    unsigned begun = insertsBegun;
+    if ((rc = countBelow(lo, false, below)) == 0 && (rc = countBelow(hi, true, upTo)) == 0)
+      count = upTo - below;
+    __sync_synchronize();
+    bool quiet = (begun == done && begun == insertsBegun);
+
+    pthread_rwlock_unlock(&splitLock);
+    if (rc < 0 || quiet)
+      return rc;
+  }
+}
+
+RC BTreeIndex::countBelow(int searchKey, bool orEqual, int& entries) const
+{
+  BTNonLeafNode nonLeafNode;
+  RC            rc;
+  PageId        pid;
+  unsigned      version;
+  int           level, height;
+
+  // descend like findLeaf(), adding up the entries under the children
+  // passed on the left
+  for (;;) {
+    unsigned rootVersion = latchRead(rootLatch);
+    pid = rootPid;
+    height = treeHeight;
+    version = latchRead(latchOf(pid));
+    if (!latchValidate(rootLatch, rootVersion))
+      continue;
+
+    entries = 0;
+    if (height == 0)
+      return 0;
+
+    for (level = 1; level < height; level++) {
+      PageId   child;
+      unsigned childVersion;
+      int      eid, before;
+
+      if ((rc = readNonLeaf(pid, level, nonLeafNode)) < 0) {
+        if (latchValidate(latchOf(pid), version))
+          return rc;
+        break;
+      }
+      nonLeafNode.locateRank(searchKey, orEqual, eid, child, before);
+      for (int i = 0; i < eid; i++)
+        before += pendingOf(nonLeafNode.getChildPtr(i));
+      childVersion = latchRead(latchOf(child));
+
+      if (!latchValidate(latchOf(pid), version))
+        break;
+      entries += before;
+      pid = child;
+      version = childVersion;
+    }
+    if (level < height)
+      continue;
+
+    BTLeafNode leaf(valueSize);
+    int        below = 0;
+    if ((rc = leaf.read(pid, pf)) == 0)
+      below = leaf.countBelow(searchKey, orEqual);
+    if (!latchValidate(latchOf(pid), version))
+      continue;
+    if (rc < 0)
+      return rc;
+
+    entries += below;
+    return 0;
+  }
+}
+
+RC BTreeIndex::readNonLeaf(PageId pid, int level, BTNonLeafNode& node) const
+{
+  RC    rc;
+  char* page;
+
+  if ((page = findUpperNode(pid)) != NULL) {
+    node.attach(page);
+    return 0;
+  }
+
+  // nonleaf nodes only change while splitLock is held exclusively. a node
+  // read while it is held shared is stable and can be copied
+  if (level > upperLevels || pthread_rwlock_tryrdlock(&splitLock) != 0)
+    return node.read(pid, pf);
+
+  if ((rc = node.read(pid, pf)) == 0) {
+    pthread_mutex_lock(&upperMutex);
+    addUpperNode(pid, level, node);
+    pthread_mutex_unlock(&upperMutex);
+  }
+  pthread_rwlock_unlock(&splitLock);
+  return rc;
+}
+
+RC BTreeIndex::writeNonLeaf(PageId pid, int level, BTNonLeafNode& node)
+{
+  RC    rc;
+  char* page;
+
+  if ((rc = node.write(pid, pf)) < 0)
+    return rc;
+
+  // inserts change the upper levels. keep their copies up to date
+  if ((page = findUpperNode(pid)) != NULL)
+    node.copyTo(page);
+  else
+    addUpperNode(pid, level, node);
+  return 0;
+}
+
+char* BTreeIndex::findUpperNode(PageId pid) const
+{
+  unsigned slot = (unsigned) pid * 2654435761u % upperNodes.size();
+
+  // linear probing. the table is never more than half full
+  while (upperNodes[slot].pid != -1) {
+    if (upperNodes[slot].pid == pid) {
+      __sync_synchronize(); // the page is set before the pid
+      return upperNodes[slot].page;
+    }
+    if (++slot == upperNodes.size()) slot = 0;
+  }
+  return NULL;
+}
+
+void BTreeIndex::addUpperNode(PageId pid, int level, BTNonLeafNode& node) const
+{
+  if (level > upperLevels || upperCount >= UPPER_NODES || findUpperNode(pid) != NULL)
+    return;
+
+  unsigned slot = (unsigned) pid * 2654435761u % upperNodes.size();
+  while (upperNodes[slot].pid != -1)
+    if (++slot == upperNodes.size()) slot = 0;
+
+  // readers may probe the table meanwhile. publish the pid last
+  upperNodes[slot].page = new char[PageFile::PAGE_SIZE];
+  node.copyTo(upperNodes[slot].page);
+  __sync_synchronize();
+  upperNodes[slot].pid = pid;
+  upperCount++;
+}
+
+volatile unsigned& BTreeIndex::latchOf(PageId pid) const
+{
+  return nodeLatches[(unsigned) pid * 2654435761u % LATCH_COUNT];
+}
+
+void BTreeIndex::latchForWrite(volatile unsigned& latch)
+{
+  // nodes can share a latch. take each latch only once
+  for (unsigned i = 0; i < writeLatches.size(); i++)
+    if (writeLatches[i] == &latch) return;
+
+  latchLock(latch);
+  writeLatches.push_back(&latch);
+}
+
+void BTreeIndex::unlatchWrites()
+{
+  for (unsigned i = 0; i < writeLatches.size(); i++)
+    latchUnlock(*writeLatches[i]);
+  writeLatches.clear();
+}
+
+void BTreeIndex::clearUpperNodes()
+{
+  for (unsigned i = 0; i < upperNodes.size(); i++) {
+    delete [] upperNodes[i].page;
+    upperNodes[i].pid = -1;
+    upperNodes[i].page = NULL;
+  }
+  upperCount = 0;
+}
+
 /*
  * Read the (key, rid) pair at the location specified by the index cursor,
  * and move foward the cursor to the next entry.
@@ -221,27 +1177,175 @@ RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
  */
 RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
 {
-  RC rc;
+  RC       rc;
+  unsigned version;
+  int      count = 0;
+  PageId   next = -1;
   
-  BTLeafNode node;  
-  if ((rc = node.read(cursor.pid, pf)) < 0)
-    return rc;
+  do {
+    version = latchRead(latchOf(cursor.pid));
 
-  if ((rc = node.readEntry(cursor.eid, key, rid)) < 0)
+    BTLeafNode node(valueSize);
+    if ((rc = node.read(cursor.pid, pf)) == 0 &&
+        (rc = node.readEntry(cursor.eid, key, rid)) == 0) {
+      count = node.getKeyCount();
+      next = node.getNextNodePtr();
+    }
+  } while (!latchValidate(latchOf(cursor.pid), version));
+
+  if (rc < 0)
     return rc;
 
-  if (++cursor.eid >= node.getKeyCount()) {
-    cursor.pid = node.getNextNodePtr();
+  if (++cursor.eid >= count) {
+    cursor.pid = next;
     cursor.eid = 0;
   }
   return 0;
 }
 
+BTreeScan::BTreeScan()
+: tree(NULL), nextPid(-1), endKey(INT_MAX), eid(0), count(0)
+{
+}
+
+RC BTreeScan::open(const BTreeIndex& index, int searchKey, int lastKey)
+{
+  RC       rc;
+  PageId   pid;
+  unsigned version;
+
+  close();
+  tree = &index;
+  endKey = lastKey;
+
+  // an empty tree has no leaf to start from
+  if ((rc = tree->findLeaf(searchKey, pid, version)) == RC_END_OF_TREE)
+    return 0;
+  if (rc < 0 || (rc = readLeaf(pid, version)) < 0)
+    return rc;
+
+  // if the leaf was split meanwhile, searchKey may have moved on to a
+  // later leaf. follow the leaves until a key of searchKey or larger
+  while ((eid = lower_bound(keys, keys + count, searchKey) - keys) == count && nextPid > 0) {
+    if ((rc = readLeaf(nextPid, latchRead(tree->latchOf(nextPid)))) < 0)
+      return rc;
+  }
+  return 0;
+}
+
+void BTreeScan::close()
+{
+  nextPid = -1;
+  eid = count = 0;
+}
+
+RC BTreeScan::readLeaf(PageId pid, unsigned version)
+{
+  RC rc;
+
+  // a leaf is never removed, so a leaf changed by a writer while
+  // it was being copied is simply copied again
+  for (;;) {
+    BTLeafNode leaf(tree->valueSize);
+    if ((rc = leaf.read(pid, tree->pf)) == 0) {
+      count = leaf.readEntries(keys, rids, values);
+      nextPid = leaf.getNextNodePtr();
+    }
+    if (latchValidate(tree->latchOf(pid), version))
+      break;
+    version = latchRead(tree->latchOf(pid));
+  }
+
+  eid = 0;
+  if (rc < 0) close();
+  return rc;
+}
+
+RC BTreeScan::next(int& key, RecordId& rid)
+{
+  RC rc;
+
+  if (tree == NULL) return RC_INVALID_CURSOR;
+
+  // skip to the next leaf once the current one is exhausted
+  while (eid >= count) {
+    if (nextPid <= 0)
+      return RC_END_OF_TREE;
+    if ((rc = readLeaf(nextPid, latchRead(tree->latchOf(nextPid)))) < 0)
+      return rc;
+  }
+
+  // the first key beyond endKey ends the scan
+  if (keys[eid] > endKey) {
+    close();
+    return RC_END_OF_TREE;
+  }
+
+  key = keys[eid];
+  rid = rids[eid];
+  eid++;
+  return 0;
+}
+
+RC BTreeScan::nextBatch(vector<IndexEntry>& entries, unsigned maxCount, vector<char>* packed)
+{
+  RC         rc = 0;
+  IndexEntry entry;
+  int        valueSize = (tree != NULL) ? tree->valueSize : 0;
+
+  entries.clear();
+  if (packed != NULL) packed->clear();
+  while (entries.size() < maxCount && (rc = next(entry.key, entry.rid)) == 0) {
+    entries.push_back(entry);
+    if (packed != NULL && valueSize > 0) {
+      // next() has moved past the entry
+      packed->resize(entries.size() * INDEX_VALUE_SIZE);
+      memcpy(&(*packed)[(entries.size() - 1) * INDEX_VALUE_SIZE], values + (eid - 1) * valueSize, valueSize);
+    }
+  }
+
+  // the end of the tree is reported once all entries have been returned
+  if (rc == RC_END_OF_TREE && !entries.empty())
+    return 0;
+  return rc;
+}
+
+/*
+ * Pack a value into the form kept by a covering index: its length + 1 in
+ * the first byte, followed by the characters. A value that does not fit
+ * is not kept, and leaves the first byte 0.
+ * @param value[IN] the value
+ * @param packed[OUT] INDEX_VALUE_SIZE bytes receiving the packed value
+ */
+void BTreeIndex::packValue(const string& value, char* packed)
+{
+  memset(packed, 0, INDEX_VALUE_SIZE);
+  if (value.size() < (unsigned) INDEX_VALUE_SIZE) {
+    packed[0] = (char) (value.size() + 1);
+    memcpy(packed + 1, value.data(), value.size());
+  }
+}
+
+/*
+ * Unpack a value packed by packValue().
+ * @param packed[IN] the packed value
+ * @param value[OUT] the value
+ * @return true if the value was kept
+ */
+bool BTreeIndex::unpackValue(const char* packed, string& value)
+{
+  unsigned char length = packed[0];
+  if (length == 0)
+    return false;
+  value.assign(packed + 1, length - 1);
+  return true;
+}
+
 void BTreeIndex::printTree(PageId pid, int level) {
   if (pid == -1)
     pid = rootPid;
   if (level == treeHeight) {
-    BTLeafNode leaf;
+    BTLeafNode leaf(valueSize);
     leaf.read(pid, pf);
     int count = leaf.getKeyCount(), key;
     RecordId rid;
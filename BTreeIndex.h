@@ -12,9 +12,14 @@
 #ifndef BTREEINDEX_H
 #define BTREEINDEX_H
 
+#include <climits>
+#include <pthread.h>
+#include <vector>
 #include "Bruinbase.h"
 #include "PageFile.h"
 #include "RecordFile.h"
+#include "BTreeNode.h"
+#include "ExternalSort.h"
              
 /**
  * The data structure to point to a particular entry at a b+tree leaf node.
@@ -29,22 +34,81 @@ typedef struct {
   int     eid;  
 } IndexCursor;
 
+// # bytes of the value column kept with each entry of a covering index
+const int INDEX_VALUE_SIZE = 32;
+
+/**
+ * A (key, RecordId) pair stored in the index.
+ */
+typedef struct {
+  int      key;
+  RecordId rid;
+} IndexEntry;
+
+/**
+ * An entry of a covering index, which also keeps the value of the tuple
+ * in the form made by BTreeIndex::packValue().
+ */
+typedef struct {
+  int      key;
+  RecordId rid;
+  char     value[INDEX_VALUE_SIZE];
+} CoveringEntry;
+
 /**
  * Implements a B-Tree index for bruinbase.
  * 
+ * Once opened, an index can be searched and inserted into by several
+ * threads at a time. Readers take no locks: every node is guarded by a
+ * versioned latch, and a reader that finds the version of a node changed
+ * after reading it starts over (optimistic lock coupling). An insert
+ * that fits in its leaf latches only the leaf, so such inserts go on side
+ * by side; the entry counts of the nodes above the leaf are brought up to
+ * date later (see pendingEntries). An insert that splits a node has the
+ * tree to itself and latches every node it modifies until it is complete.
+ * open(), close() and bulk loading must not run concurrently with other
+ * calls.
  */
 class BTreeIndex {
  public:
+  /// the on-disk format of the index. version 1 interleaved the keys with
+  /// the RecordIds/PageIds in a node; version 2 stores all keys of a node
+  /// contiguously, followed by the RecordIds/PageIds; version 3 adds the
+  /// number of leaf entries under each child to the nonleaf nodes.
+  static const int FORMAT_VERSION = 3;
+
+  /// # versioned latches guarding the nodes. nodes share the latches
+  /// by the hash of their PageId
+  static const int LATCH_COUNT = 1024;
+
+  /// the default fraction of a node filled by bulk loading
+  static const double DEFAULT_FILL_FACTOR;
+
+  /// # entries sorted in memory by bulk loading before they are spilled
+  /// to a temporary run file. a covering index sorts as many entries as
+  /// fit in the same memory
+  static const int SORT_BUFFER_ENTRIES = 1 << 20;
+
+  /// the memory (in bytes) used to keep the nonleaf nodes of the upper
+  /// levels of an open index, so that lookups do not read them again
+  static const int UPPER_LEVEL_BUDGET = 1 << 20;
+
   BTreeIndex();
+  ~BTreeIndex();
 
   /**
    * Open the index file in read or write mode.
-   * Under 'w' mode, the index file should be created if it does not exist.
+   * Under 'w' mode, the index file should be created if it does not exist,
+   * and an index in an older format is converted to FORMAT_VERSION.
+   * Under 'r' mode, an index in an older format cannot be opened.
    * @param indexname[IN] the name of the index file
    * @param mode[IN] 'r' for read, 'w' for write
+   * @param covering[IN] whether a newly created index keeps the value
+   *                     column in its leaves. an existing index keeps
+   *                     the kind it was created with
    * @return error code. 0 if no error
    */
-  RC open(const std::string& indexname, char mode);
+  RC open(const std::string& indexname, char mode, bool covering = false);
 
   /**
    * Close the index file.
@@ -60,7 +124,54 @@ class BTreeIndex {
    */
   RC insert(int key, const RecordId& rid);
 
-  RC insertHelper(int key, const RecordId& rid, PageId nodeId, int level, int& keyUp, PageId& newNodeId);
+  /**
+   * Insert (key, RecordId) pair to the index, together with the value
+   * of the record if the index is covering.
+   * @param key[IN] the key for the value inserted into the index
+   * @param rid[IN] the RecordId for the record being inserted into the index
+   * @param value[IN] the value of the record
+   * @return error code. 0 if no error
+   */
+  RC insert(int key, const RecordId& rid, const std::string& value);
+
+  RC insertHelper(const IndexEntry& entry, const char* value, PageId nodeId, int level, int& keyUp, PageId& newNodeId, int& newEntries);
+
+  /**
+   * Start building an empty index bottom-up. The entries passed to
+   * bulkInsert() are sorted (with an external merge sort if they do not
+   * fit in memory) and packed into leaves by endBulkLoad(), and the
+   * nonleaf levels are then built on top of the leaves. Every node is
+   * written exactly once.
+   * @param fillFactor[IN] the fraction of every node to fill
+   * @return error code. 0 if no error. RC_INVALID_FILE_FORMAT if
+   *         the index is not empty.
+   */
+  RC beginBulkLoad(double fillFactor = DEFAULT_FILL_FACTOR);
+
+  /**
+   * Add a (key, RecordId) pair to the index being bulk loaded.
+   * The pairs can be given in any order.
+   * @param key[IN] the key for the value inserted into the index
+   * @param rid[IN] the RecordId for the record being inserted into the index
+   * @return error code. 0 if no error
+   */
+  RC bulkInsert(int key, const RecordId& rid);
+
+  /**
+   * Add a (key, RecordId) pair to the index being bulk loaded, together
+   * with the value of the record if the index is covering.
+   * @param key[IN] the key for the value inserted into the index
+   * @param rid[IN] the RecordId for the record being inserted into the index
+   * @param value[IN] the value of the record
+   * @return error code. 0 if no error
+   */
+  RC bulkInsert(int key, const RecordId& rid, const std::string& value);
+
+  /**
+   * Build the index from the pairs added by bulkInsert().
+   * @return error code. 0 if no error
+   */
+  RC endBulkLoad();
 
   /**
    * Run the standard B+Tree key search algorithm and identify the
@@ -91,18 +202,247 @@ class BTreeIndex {
    * @return error code. 0 if no error
    */
   RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
+
+  /**
+   * Count the entries whose key lies in [lo, hi] from the entry counts
+   * kept in the nonleaf nodes, without reading the leaves in between.
+   * Inserts go on while the entries are counted; the count is started
+   * over if one ran in between, and after a few tries inserts wait.
+   * @param lo[IN] the smallest key to count
+   * @param hi[IN] the largest key to count
+   * @param count[OUT] the number of entries
+   * @return error code. 0 if no error
+   */
+  RC countRange(int lo, int hi, int& count) const;
+
+  /**
+   * @return true if the leaves of the index keep the value column
+   */
+  bool isCovering() const { return valueSize > 0; }
+
+  /**
+   * Pack a value into the form kept by a covering index. A value too
+   * long to fit is not kept.
+   * @param value[IN] the value
+   * @param packed[OUT] INDEX_VALUE_SIZE bytes receiving the packed value
+   */
+  static void packValue(const std::string& value, char* packed);
+
+  /**
+   * Unpack a value packed by packValue().
+   * @param packed[IN] the packed value
+   * @param value[OUT] the value
+   * @return true if the value was kept. false if it has to be read from
+   *         the table
+   */
+  static bool unpackValue(const char* packed, std::string& value);
   
   void printTree(PageId pid, int level);
 
  private:
+  friend class BTreeScan;
+
+  /**
+   * Descend from the root to the leaf node where searchKey may exist.
+   * The caller reads the leaf and checks afterwards that the version of
+   * its latch is unchanged.
+   * @param searchKey[IN] the key to find
+   * @param pid[OUT] the PageId of the leaf node
+   * @param version[OUT] the version of the latch of the leaf node
+   * @return error code. 0 if no error. RC_END_OF_TREE if the tree is empty
+   */
+  RC findLeaf(int searchKey, PageId& pid, unsigned& version) const;
+
+  /**
+   * Count the entries whose key is smaller than searchKey, or smaller
+   * than or equal to searchKey if orEqual is set, with one descent from
+   * the root.
+   * @return error code. 0 if no error
+   */
+  RC countBelow(int searchKey, bool orEqual, int& entries) const;
+
+  /// count the entries under node pid at the given level
+  RC countEntries(PageId pid, int level, int& entries) const;
+
+  /// count the entries under a nonleaf node, with those still pending
+  int entriesUnder(BTNonLeafNode& node) const;
+
+  /// the # entries pending for node pid
+  int pendingOf(PageId pid) const;
+
+  /// make room in pendingEntries for every node of the index file
+  void growPending();
+
+  /**
+   * Add the entries pending for the children of node pid at the given
+   * level, and of all nodes below it, to the counts kept in the nodes.
+   * splitLock must be held exclusively.
+   * @return error code. 0 if no error
+   */
+  RC flushPending(PageId pid, int level);
+
+  /**
+   * Read the nonleaf node pid at the given level (the root is level 1).
+   * Nodes of the upper levels are served from memory.
+   * @return error code. 0 if no error
+   */
+  RC readNonLeaf(PageId pid, int level, BTNonLeafNode& node) const;
+
+  /**
+   * Write the nonleaf node pid at the given level, updating the
+   * copy kept in memory. The latch of the node must be held.
+   * @return error code. 0 if no error
+   */
+  RC writeNonLeaf(PageId pid, int level, BTNonLeafNode& node);
+
+  /// the latch guarding node pid
+  volatile unsigned& latchOf(PageId pid) const;
+
+  /// latch a node modified by an insert until unlatchWrites() is called
+  void latchForWrite(volatile unsigned& latch);
+
+  /// release the latches taken by latchForWrite()
+  void unlatchWrites();
+
+  /// return the copy of node pid kept in memory (NULL if none)
+  char* findUpperNode(PageId pid) const;
+
+  /// keep a copy of node pid in memory if it is in the upper levels
+  /// and the budget allows
+  void addUpperNode(PageId pid, int level, BTNonLeafNode& node) const;
+
+  /// free the copies of the upper level nodes
+  void clearUpperNodes();
+
+  BTreeIndex(const BTreeIndex&);            // indexes are not copyable
+  BTreeIndex& operator=(const BTreeIndex&);
+
   PageFile pf;         /// the PageFile used to store the actual b+tree in disk
 
+  char     fileMode;   /// the mode the index file was opened in
+
   PageId   rootPid;    /// the PageId of the root node
   int      treeHeight; /// the height of the tree
   /// Note that the content of the above two variables will be gone when
   /// this class is destructed. Make sure to store the values of the two 
   /// variables in disk, so that they can be reconstructed when the index
   /// is opened again later.
+
+  int      valueSize;  /// # bytes of the value kept with a leaf entry
+
+  /// a nonleaf node kept in memory
+  typedef struct {
+    PageId pid;   // the node PageId (-1 for an empty slot)
+    char*  page;  // the copy of the node page
+  } UpperNode;
+
+  mutable volatile unsigned nodeLatches[LATCH_COUNT]; /// the node latches
+  mutable volatile unsigned rootLatch;  /// guards rootPid and treeHeight
+  /// held shared by inserts that fit in their leaf and by counts, and
+  /// exclusively by inserts that split a node. nonleaf nodes only change
+  /// while it is held exclusively
+  mutable pthread_rwlock_t splitLock;
+  mutable pthread_mutex_t upperMutex;   /// serializes additions to upperNodes
+  std::vector<volatile unsigned*> writeLatches; /// latches held by an insert
+
+  /// open-addressed hash table of the upper level nodes, keyed by pid
+  mutable std::vector<UpperNode> upperNodes;
+  mutable int upperCount;  /// # nodes in upperNodes
+  int         upperLevels; /// # levels from the root that are kept
+
+  /// # entries inserted under each node (by PageId) that the count kept
+  /// for it in its parent does not include yet. inserts that fit in their
+  /// leaf only add to these; the next split of a node moves its pending
+  /// entries into its parent, and close() moves all that are left
+  std::vector<int> pendingEntries;
+
+  /// # inserts that fit in their leaf begun and completed so far. a count
+  /// that saw both equal before and after counting saw no insert midway
+  volatile unsigned insertsBegun;
+  volatile unsigned insertsDone;
+
+  /// insert an entry made by insert(), with its packed value if the
+  /// index is covering (NULL otherwise)
+  RC insertEntry(const IndexEntry& entry, const char* value);
+
+  /// insert an entry into its leaf without splitting any node. splitLock
+  /// must be held shared. return RC_NODE_FULL if the leaf is full or
+  /// the tree is empty
+  RC insertLeaf(const IndexEntry& entry, const char* value);
+
+  /// write rootPid, treeHeight, the format version and valueSize to page 0
+  RC writeMetadata();
+
+  /// convert an index of an older format version to the current format
+  RC convertFormat(int version);
+
+  /// discard the state of an unfinished bulk load
+  void abortBulkLoad();
+
+  bool   bulkLoading; /// true between begin/endBulkLoad()
+  double bulkFill;    /// the fill factor of the bulk load
+  ExternalSort<IndexEntry>    bulkEntries;  /// the entries of a bulk load
+  ExternalSort<CoveringEntry> bulkCovering; /// the same, for a covering index
+};
+
+/**
+ * A cursor for range scans over a BTreeIndex. The entries of the current
+ * leaf node are copied at once and returned from the copy, so every leaf
+ * is read only once; the scan moves to the next leaf at the end of the
+ * node. Entries inserted into a leaf after it was copied are not returned.
+ */
+class BTreeScan {
+ public:
+  BTreeScan();
+
+  /**
+   * Position the scan at the first entry whose key is searchKey or larger.
+   * @param tree[IN] the index to scan. it must stay open during the scan
+   * @param searchKey[IN] the smallest key to return
+   * @param endKey[IN] the largest key to return. the scan ends at the
+   *                   first key beyond it without reading further leaves
+   * @return error code. 0 if no error
+   */
+  RC open(const BTreeIndex& tree, int searchKey, int endKey = INT_MAX);
+
+  /**
+   * Read the next (key, rid) pair and advance the scan.
+   * @param key[OUT] the key of the entry
+   * @param rid[OUT] the RecordId of the entry
+   * @return error code. 0 if no error. RC_END_OF_TREE if no entry is left
+   */
+  RC next(int& key, RecordId& rid);
+
+  /**
+   * Read up to maxCount next (key, rid) pairs and advance the scan.
+   * @param entries[OUT] the entries read, in key order
+   * @param maxCount[IN] the maximum number of entries to read
+   * @param packed[OUT] if not NULL and the index is covering, the packed
+   *                    values of the entries, INDEX_VALUE_SIZE bytes each
+   * @return error code. 0 if no error. RC_END_OF_TREE if no entry is left
+   */
+  RC nextBatch(std::vector<IndexEntry>& entries, unsigned maxCount, std::vector<char>* packed = NULL);
+
+  /**
+   * Finish the scan.
+   */
+  void close();
+
+ private:
+  BTreeScan(const BTreeScan&);              // scans are not copyable
+  BTreeScan& operator=(const BTreeScan&);
+
+  // copy the entries of leaf pid, whose latch had the given version
+  RC readLeaf(PageId pid, unsigned version);
+
+  const BTreeIndex* tree; // the index being scanned
+  PageId   nextPid;       // the leaf after the current one (<= 0 if none)
+  int      endKey;        // the largest key to return
+  int      eid;           // the next entry to return
+  int      count;         // # entries of the current leaf
+  int      keys[BTLeafNode::ENTRIES_PER_PAGE];      // the entries of
+  RecordId rids[BTLeafNode::ENTRIES_PER_PAGE];      //   the current leaf
+  char     values[PageFile::PAGE_SIZE];             //   and their values
 };
 
 #endif /* BTREEINDEX_H */
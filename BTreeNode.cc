@@ -1,12 +1,79 @@
 #include "BTreeNode.h"
+#include "KeySearch.h"
+#include <climits>
 #include <cstring>
 #include <iostream>
 
 using namespace std;
 
-BTLeafNode::BTLeafNode()
+// the content of a newly constructed, empty node
+static const char emptyPage[PageFile::PAGE_SIZE] = { 0 };
+
+// byte offset of the key array in a leaf node page. the RecordId and
+// value arrays follow it at offsets that depend on the size of the values
+static const int LEAF_KEYS = sizeof(int);
+
+// byte offsets of the key, child PageId and child entry count arrays
+// in a nonleaf node page
+static const int NONLEAF_KEYS = sizeof(int);
+static const int NONLEAF_PIDS = sizeof(int) + BTNonLeafNode::KEYS_PER_PAGE * sizeof(int);
+static const int NONLEAF_COUNTS = NONLEAF_PIDS + (BTNonLeafNode::KEYS_PER_PAGE + 1) * sizeof(PageId);
+
+// the counting kernel picked for this CPU
+static const CountLessKernel countLess = selectCountLessKernel();
+
+// return the # keys smaller than searchKey in a sorted key array
+static int lowerBound(const char* keys, int count, int searchKey)
 {
-  memset(buffer, 0, PageFile::PAGE_SIZE);
+  return lowerBoundWith(countLess, keys, count, searchKey);
+}
+
+// return the # keys smaller than or equal to searchKey in a sorted key array
+static int upperBound(const char* keys, int count, int searchKey)
+{
+  if (searchKey == INT_MAX) return count;
+  return lowerBound(keys, count, searchKey + 1);
+}
+
+BTLeafNode::BTLeafNode(int valueSize)
+: valueSize(valueSize), maxEntries(entriesPerPage(valueSize)),
+  ridOffset(LEAF_KEYS + maxEntries * sizeof(int)),
+  valueOffset(ridOffset + maxEntries * sizeof(RecordId)),
+  data(emptyPage), pinned(NULL) {}
+
+/*
+ * Return the maximum number of entries of a leaf keeping valueSize
+ * bytes of the value column with each entry.
+ * @param valueSize[IN] the number of value bytes of an entry
+ * @return the number of entries that fit in a page
+ */
+int BTLeafNode::entriesPerPage(int valueSize)
+{
+  return (PageFile::PAGE_SIZE - sizeof(int) - sizeof(PageId)) / (ENTRY_SIZE + valueSize);
+}
+
+BTLeafNode::~BTLeafNode()
+{
+  release();
+}
+
+void BTLeafNode::release()
+{
+  if (pinned != NULL) {
+    pinned->unpin(data);
+    pinned = NULL;
+    data = emptyPage;
+  }
+}
+
+char* BTLeafNode::writable()
+{
+  if (data != buffer) {
+    memcpy(buffer, data, PageFile::PAGE_SIZE);
+    release();
+    data = buffer;
+  }
+  return buffer;
 }
 
 /*
@@ -16,7 +83,18 @@ BTLeafNode::BTLeafNode()
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::read(PageId pid, const PageFile& pf)
-{ return pf.read(pid, buffer); }
+{
+  RC rc;
+  const char* page;
+
+  if ((rc = pf.pin(pid, page)) < 0)
+    return rc;
+
+  release();
+  data = page;
+  pinned = &pf;
+  return 0;
+}
     
 /*
  * Write the content of the node to the page pid in the PageFile pf.
@@ -25,7 +103,7 @@ RC BTLeafNode::read(PageId pid, const PageFile& pf)
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::write(PageId pid, PageFile& pf)
-{ return pf.write(pid, buffer); }
+{ return pf.write(pid, data); }
 
 /*
  * Return the number of keys stored in the node.
@@ -36,7 +114,7 @@ int BTLeafNode::getKeyCount()
   int count;
 
   // the first four bytes of a page contains # records in the node
-  memcpy(&count, buffer, sizeof(int));
+  memcpy(&count, data, sizeof(int));
   return count;
 }
 
@@ -44,25 +122,35 @@ int BTLeafNode::getKeyCount()
  * Insert a (key, rid) pair to the node.
  * @param key[IN] the key to insert
  * @param rid[IN] the RecordId to insert
+ * @param value[IN] the value bytes of the entry (zeros if NULL)
  * @return 0 if successful. Return an error code if the node is full.
  */
-RC BTLeafNode::insert(int key, const RecordId& rid)
+RC BTLeafNode::insert(int key, const RecordId& rid, const char* value)
 {
   int count = getKeyCount();
   
-  if (count == ENTRIES_PER_PAGE)
+  if (count == maxEntries)
     return RC_NODE_FULL;
   
   int eid;
   locate(key, eid); // We assume no duplicate keys
   
-  char *ptr = buffer + sizeof(int) + eid*ENTRY_SIZE;
-  if (eid != count) {
-    memmove(ptr + ENTRY_SIZE, ptr, (count - eid) * ENTRY_SIZE); // shift right
+  char *buffer = writable();
+  char *kptr = buffer + LEAF_KEYS + eid*sizeof(int);
+  char *rptr = buffer + ridOffset + eid*sizeof(RecordId);
+  char *vptr = buffer + valueOffset + eid*valueSize;
+  if (eid != count) { // shift right
+    memmove(kptr + sizeof(int), kptr, (count - eid) * sizeof(int));
+    memmove(rptr + sizeof(RecordId), rptr, (count - eid) * sizeof(RecordId));
+    memmove(vptr + valueSize, vptr, (count - eid) * valueSize);
   }
-  // store the recordId and key
-  memcpy(ptr, &rid, sizeof(RecordId));
-  memcpy(ptr + sizeof(RecordId), &key, sizeof(int));
+  // store the key, recordId and value
+  memcpy(kptr, &key, sizeof(int));
+  memcpy(rptr, &rid, sizeof(RecordId));
+  if (value != NULL)
+    memcpy(vptr, value, valueSize);
+  else
+    memset(vptr, 0, valueSize);
   
   count++;
   memcpy(buffer, &count, sizeof(int)); // update the count
@@ -77,39 +165,48 @@ RC BTLeafNode::insert(int key, const RecordId& rid)
  * @param rid[IN] the RecordId to insert.
  * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
  * @param siblingKey[OUT] the first key in the sibling node after split.
+ * @param value[IN] the value bytes of the entry (zeros if NULL)
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::insertAndSplit(int key, const RecordId& rid, 
-                              BTLeafNode& sibling, int& siblingKey)
+                              BTLeafNode& sibling, int& siblingKey,
+                              const char* value)
 {
-  if (sibling.getKeyCount() > 0)
+  if (sibling.getKeyCount() > 0 || sibling.valueSize != valueSize)
     return -1;
 
-  const int half = ENTRIES_PER_PAGE / 2 + 1;
-  int eid, split = half;
-  char copy[half * ENTRY_SIZE];
+  int      count = getKeyCount(), eid;
+  int      keys[ENTRIES_PER_PAGE + 1];
+  RecordId rids[ENTRIES_PER_PAGE + 1];
+  char     values[2 * PageFile::PAGE_SIZE]; // (maxEntries + 1) values fit
   locate(key, eid); // We assume no duplicate keys
-  
-  if (eid < half) // Ensure that the left one has (n+1)/2 keys
-    split--;
-
-  //int ikey;
-  RecordId irid;
-  /*for (int i = split; i < ENTRIES_PER_PAGE; i++) {
-    readEntry(i, ikey, irid);
-    sibling.insert(ikey, irid);
-  }*/
-  memcpy(copy, buffer + sizeof(int) + split*ENTRY_SIZE, (ENTRIES_PER_PAGE - split)*ENTRY_SIZE);
-  sibling.splitFromSibling(ENTRIES_PER_PAGE - split, copy);
-  
-  memcpy(buffer, &split, sizeof(int)); // update the counter
-  
-  if (split < half)
-    insert(key, rid);
+
+  // lay out all entries including the new one in order
+  memcpy(keys, data + LEAF_KEYS, eid * sizeof(int));
+  memcpy(rids, data + ridOffset, eid * sizeof(RecordId));
+  memcpy(values, data + valueOffset, eid * valueSize);
+  keys[eid] = key;
+  rids[eid] = rid;
+  if (value != NULL)
+    memcpy(values + eid*valueSize, value, valueSize);
   else
-    sibling.insert(key, rid);
+    memset(values + eid*valueSize, 0, valueSize);
+  memcpy(keys + eid + 1, data + LEAF_KEYS + eid*sizeof(int), (count - eid) * sizeof(int));
+  memcpy(rids + eid + 1, data + ridOffset + eid*sizeof(RecordId), (count - eid) * sizeof(RecordId));
+  memcpy(values + (eid + 1)*valueSize, data + valueOffset + eid*valueSize, (count - eid) * valueSize);
+  count++;
+
+  // Ensure that the left one has (n+1)/2 keys
+  int half = (count + 1) / 2;
+  sibling.splitFromSibling(count - half, keys + half, rids + half, values + half*valueSize);
+
+  char *buffer = writable();
+  memcpy(buffer, &half, sizeof(int)); // update the counter
+  memcpy(buffer + LEAF_KEYS, keys, half * sizeof(int));
+  memcpy(buffer + ridOffset, rids, half * sizeof(RecordId));
+  memcpy(buffer + valueOffset, values, half * valueSize);
 
-  sibling.readEntry(0, siblingKey, irid);
+  siblingKey = keys[half];
   return 0;
 }
 
@@ -126,17 +223,16 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
  */
 RC BTLeafNode::locate(int searchKey, int& eid)
 {
-  int count = getKeyCount(), key, i;
-  char *ptr = buffer + sizeof(int) + sizeof(RecordId);
-  for (i = 0; i < count; i++, ptr += ENTRY_SIZE) {
-    memcpy(&key, ptr, sizeof(int));
-    if (key == searchKey) {
-      eid = i;
-      return 0;
-    }
-    if (key > searchKey) break;
-  }
-  eid = i;
+  int count = getKeyCount();
+  const char *keys = data + LEAF_KEYS;
+
+  // a node read while a writer changes it can be inconsistent. the reader
+  // tries again later, but the search must stay within the page
+  if (count < 0 || count > maxEntries) count = 0;
+
+  eid = lowerBound(keys, count, searchKey);
+  if (eid < count && keyAt(keys, eid) == searchKey)
+    return 0;
   return RC_NO_SUCH_RECORD;
 }
 
@@ -151,17 +247,59 @@ RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid)
 {
   if (eid < 0 || eid >= getKeyCount())
     return RC_INVALID_RID;
-  char *ptr = buffer + sizeof(int) + eid*ENTRY_SIZE;
-  memcpy(&rid, ptr, sizeof(RecordId));  
-  memcpy(&key, ptr + sizeof(RecordId), sizeof(int));
+  memcpy(&key, data + LEAF_KEYS + eid*sizeof(int), sizeof(int));
+  memcpy(&rid, data + ridOffset + eid*sizeof(RecordId), sizeof(RecordId));  
   return 0;
 }
 
-RC BTLeafNode::splitFromSibling(int count, char *copy) {
-  if (getKeyCount() > 0)
+/*
+ * Copy all (key, rid) pairs of the node.
+ * @param keys[OUT] the keys of the entries
+ * @param rids[OUT] the RecordIds of the entries
+ * @param values[OUT] the value bytes of the entries, one after another.
+ *                    not copied if NULL
+ * @return the number of entries copied
+ */
+int BTLeafNode::readEntries(int* keys, RecordId* rids, char* values)
+{
+  int count = getKeyCount();
+
+  if (count < 0 || count > maxEntries) count = 0;
+  memcpy(keys, data + LEAF_KEYS, count * sizeof(int));
+  memcpy(rids, data + ridOffset, count * sizeof(RecordId));
+  if (values != NULL)
+    memcpy(values, data + valueOffset, count * valueSize);
+  return count;
+}
+
+/*
+ * Return the number of entries whose key is smaller than searchKey,
+ * or smaller than or equal to searchKey if orEqual is set.
+ * @param searchKey[IN] the key to compare with
+ * @param orEqual[IN] whether the entries with searchKey are counted
+ * @return the number of entries
+ */
+int BTLeafNode::countBelow(int searchKey, bool orEqual)
+{
+  int count = getKeyCount();
+
+  if (count < 0 || count > maxEntries) count = 0;
+  if (orEqual)
+    return upperBound(data + LEAF_KEYS, count, searchKey);
+  return lowerBound(data + LEAF_KEYS, count, searchKey);
+}
+
+RC BTLeafNode::splitFromSibling(int count, const int* keys, const RecordId* rids, const char* values) {
+  if (getKeyCount() > 0 || count > maxEntries)
     return -1;
+  char *buffer = writable();
   memcpy(buffer, &count, sizeof(int));
-  memcpy(buffer + sizeof(int), copy, count * ENTRY_SIZE);
+  memcpy(buffer + LEAF_KEYS, keys, count * sizeof(int));
+  memcpy(buffer + ridOffset, rids, count * sizeof(RecordId));
+  if (values != NULL)
+    memcpy(buffer + valueOffset, values, count * valueSize);
+  else
+    memset(buffer + valueOffset, 0, count * valueSize);
   return 0;
 }
 
@@ -172,7 +310,7 @@ RC BTLeafNode::splitFromSibling(int count, char *copy) {
 PageId BTLeafNode::getNextNodePtr()
 {
   PageId next;
-  memcpy(&next, buffer + PageFile::PAGE_SIZE - sizeof(PageId), sizeof(PageId));
+  memcpy(&next, data + PageFile::PAGE_SIZE - sizeof(PageId), sizeof(PageId));
   return next;
 }
 
@@ -182,13 +320,35 @@ PageId BTLeafNode::getNextNodePtr()
  */
 void BTLeafNode::setNextNodePtr(PageId pid)
 {
-  memcpy(buffer + PageFile::PAGE_SIZE - sizeof(PageId), &pid, sizeof(PageId));
+  memcpy(writable() + PageFile::PAGE_SIZE - sizeof(PageId), &pid, sizeof(PageId));
 }
 
 
 BTNonLeafNode::BTNonLeafNode()
+: data(emptyPage), pinned(NULL) {}
+
+BTNonLeafNode::~BTNonLeafNode()
+{
+  release();
+}
+
+void BTNonLeafNode::release()
+{
+  if (pinned != NULL) {
+    pinned->unpin(data);
+    pinned = NULL;
+    data = emptyPage;
+  }
+}
+
+char* BTNonLeafNode::writable()
 {
-  memset(buffer, 0, PageFile::PAGE_SIZE);
+  if (data != buffer) {
+    memcpy(buffer, data, PageFile::PAGE_SIZE);
+    release();
+    data = buffer;
+  }
+  return buffer;
 }
 
 /*
@@ -198,7 +358,37 @@ BTNonLeafNode::BTNonLeafNode()
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
-{ return pf.read(pid, buffer); }
+{
+  RC rc;
+  const char* page;
+
+  if ((rc = pf.pin(pid, page)) < 0)
+    return rc;
+
+  release();
+  data = page;
+  pinned = &pf;
+  return 0;
+}
+
+/*
+ * Use a copy of a node page kept in memory as the content of the node.
+ * @param page[IN] the node page
+ */
+void BTNonLeafNode::attach(const char* page)
+{
+  release();
+  data = page;
+}
+
+/*
+ * Copy the content of the node to a page in memory.
+ * @param page[OUT] the buffer of PageFile::PAGE_SIZE bytes to copy to
+ */
+void BTNonLeafNode::copyTo(char* page)
+{
+  memcpy(page, data, PageFile::PAGE_SIZE);
+}
     
 /*
  * Write the content of the node to the page pid in the PageFile pf.
@@ -207,7 +397,7 @@ RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTNonLeafNode::write(PageId pid, PageFile& pf)
-{ return pf.write(pid, buffer); }
+{ return pf.write(pid, data); }
 
 /*
  * Return the number of keys stored in the node.
@@ -218,18 +408,67 @@ int BTNonLeafNode::getKeyCount()
   int count;
 
   // the first four bytes of a page contains # records in the node
-  memcpy(&count, buffer, sizeof(int));
+  memcpy(&count, data, sizeof(int));
   return count;
 }
 
 
+/*
+ * Return the total number of leaf entries under the node.
+ * @return the sum of the entry counts of the children
+ */
+int BTNonLeafNode::getEntryCount()
+{
+  int count = getKeyCount(), total = 0;
+
+  if (count < 0 || count > KEYS_PER_PAGE) count = 0;
+  for (int i = 0; i <= count; i++)
+    total += getChildEntries(i);
+  return total;
+}
+
+/*
+ * Return the number of leaf entries under the eid'th child.
+ * @param eid[IN] the child number, from 0 to getKeyCount()
+ * @return the number of entries under the child
+ */
+int BTNonLeafNode::getChildEntries(int eid)
+{
+  int entries;
+  memcpy(&entries, data + NONLEAF_COUNTS + eid*sizeof(int), sizeof(int));
+  return entries;
+}
+
+/*
+ * Return the eid'th child PageId.
+ * @param eid[IN] the child number, from 0 to getKeyCount()
+ * @return the PageId of the child
+ */
+PageId BTNonLeafNode::getChildPtr(int eid)
+{
+  PageId pid;
+  memcpy(&pid, data + NONLEAF_PIDS + eid*sizeof(PageId), sizeof(PageId));
+  return pid;
+}
+
+/*
+ * Set the number of leaf entries under the eid'th child.
+ * @param eid[IN] the child number, from 0 to getKeyCount()
+ * @param entries[IN] the number of entries under the child
+ */
+void BTNonLeafNode::setChildEntries(int eid, int entries)
+{
+  memcpy(writable() + NONLEAF_COUNTS + eid*sizeof(int), &entries, sizeof(int));
+}
+
 /*
  * Insert a (key, pid) pair to the node.
  * @param key[IN] the key to insert
  * @param pid[IN] the PageId to insert
+ * @param entries[IN] the number of leaf entries under pid
  * @return 0 if successful. Return an error code if the node is full.
  */
-RC BTNonLeafNode::insert(int key, PageId pid)
+RC BTNonLeafNode::insert(int key, PageId pid, int entries)
 {
   int count = getKeyCount();
   
@@ -239,13 +478,20 @@ RC BTNonLeafNode::insert(int key, PageId pid)
   int eid;
   locate(key, eid);
   
-  char *ptr = buffer + sizeof(int) + sizeof(PageId) + eid*ENTRY_SIZE;
-  if (eid != count) {
-    memmove(ptr + ENTRY_SIZE, ptr, (count - eid) * ENTRY_SIZE); // shift right
+  // the new pid and its count go right after the new key
+  char *buffer = writable();
+  char *kptr = buffer + NONLEAF_KEYS + eid*sizeof(int);
+  char *pptr = buffer + NONLEAF_PIDS + (eid + 1)*sizeof(PageId);
+  char *cptr = buffer + NONLEAF_COUNTS + (eid + 1)*sizeof(int);
+  if (eid != count) { // shift right
+    memmove(kptr + sizeof(int), kptr, (count - eid) * sizeof(int));
+    memmove(pptr + sizeof(PageId), pptr, (count - eid) * sizeof(PageId));
+    memmove(cptr + sizeof(int), cptr, (count - eid) * sizeof(int));
   }
-  // store the key and pageId
-  memcpy(ptr, &key, sizeof(int));
-  memcpy(ptr + sizeof(int), &pid, sizeof(PageId));
+  // store the key, pageId and count
+  memcpy(kptr, &key, sizeof(int));
+  memcpy(pptr, &pid, sizeof(PageId));
+  memcpy(cptr, &entries, sizeof(int));
   
   count++;
   memcpy(buffer, &count, sizeof(int)); // update the count
@@ -258,72 +504,55 @@ RC BTNonLeafNode::insert(int key, PageId pid)
  * The middle key after the split is returned in midKey.
  * @param key[IN] the key to insert
  * @param pid[IN] the PageId to insert
+ * @param entries[IN] the number of leaf entries under pid
  * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
  * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey)
+RC BTNonLeafNode::insertAndSplit(int key, PageId pid, int entries, BTNonLeafNode& sibling, int& midKey)
 {  
   if (sibling.getKeyCount() > 0)
     return -1;
 
-  int eid, half = (KEYS_PER_PAGE + 1) / 2;
-  const int sibSize = (KEYS_PER_PAGE/2)*ENTRY_SIZE;
-  char copy[sibSize];
+  int    count = getKeyCount(), eid;
+  int    keys[KEYS_PER_PAGE + 1];
+  PageId pids[KEYS_PER_PAGE + 2];
+  int    counts[KEYS_PER_PAGE + 2];
   locate(key, eid);
-  
+
+  // lay out all keys, pointers and counts including the new ones in order
+  memcpy(keys, data + NONLEAF_KEYS, eid * sizeof(int));
+  memcpy(pids, data + NONLEAF_PIDS, (eid + 1) * sizeof(PageId));
+  memcpy(counts, data + NONLEAF_COUNTS, (eid + 1) * sizeof(int));
+  keys[eid] = key;
+  pids[eid + 1] = pid;
+  counts[eid + 1] = entries;
+  memcpy(keys + eid + 1, data + NONLEAF_KEYS + eid*sizeof(int), (count - eid) * sizeof(int));
+  memcpy(pids + eid + 2, data + NONLEAF_PIDS + (eid + 1)*sizeof(PageId), (count - eid) * sizeof(PageId));
+  memcpy(counts + eid + 2, data + NONLEAF_COUNTS + (eid + 1)*sizeof(int), (count - eid) * sizeof(int));
+  count++;
+
+  // the left node keeps the first half of the keys, the middle key
+  // moves up and the sibling gets the rest
+  int half = count / 2;
+  midKey = keys[half];
+  sibling.splitFromSibling(count - half - 1, keys + half + 1, pids + half + 1, counts + half + 1);
+
+  char *buffer = writable();
   memcpy(buffer, &half, sizeof(int)); // update the count
-  
-  PageId sibPid1;//, sibPid;
-  //int sibKey;
-  char *ptr = buffer + sizeof(int) + sizeof(PageId);
-  if (eid == half) {
-    midKey = key;
-    sibPid1 = pid;
-  } else if (eid < half) {
-    half--;
-    memcpy(&midKey, ptr + half*ENTRY_SIZE, sizeof(int));
-    memcpy(&sibPid1, ptr + half*ENTRY_SIZE + sizeof(int), sizeof(PageId));
-    
-    char *tmp = ptr + eid * ENTRY_SIZE;
-    memmove(tmp + ENTRY_SIZE, tmp, (half - eid)*ENTRY_SIZE);
-    memcpy(tmp, &key, sizeof(int));
-    memcpy(tmp + sizeof(int), &pid, sizeof(PageId));
-    half++;
-  } else {
-    memcpy(&midKey, ptr + half*ENTRY_SIZE, sizeof(int));
-    memcpy(&sibPid1, ptr + half*ENTRY_SIZE + sizeof(int), sizeof(PageId));
-    
-    memmove(ptr + half*ENTRY_SIZE, ptr + (half+1)*ENTRY_SIZE, (eid - half)*ENTRY_SIZE);
-    memcpy(ptr + eid*ENTRY_SIZE, &key, sizeof(int));
-    memcpy(ptr + eid*ENTRY_SIZE + sizeof(int), &pid, sizeof(PageId));    
-  }
-  
-  ptr += half*ENTRY_SIZE;
-  memcpy(copy, ptr, sibSize);
-  sibling.splitFromSibling(KEYS_PER_PAGE/2, sibPid1, copy, sibSize);
-  /*memcpy(&sibKey, ptr, sizeof(int));
-  memcpy(&sibPid, ptr + sizeof(int), sizeof(PageId));
-  ptr += ENTRY_SIZE;
-  
-  sibling.initializeRoot(sibPid1, sibKey, sibPid);
-  for (int i = half + 1; i < KEYS_PER_PAGE; i++, ptr += ENTRY_SIZE) {
-    memcpy(&sibKey, ptr, sizeof(int));
-    memcpy(&sibPid, ptr + sizeof(int), sizeof(PageId));
-    sibling.insert(sibKey, sibPid);
-  }*/
+  memcpy(buffer + NONLEAF_KEYS, keys, half * sizeof(int));
+  memcpy(buffer + NONLEAF_PIDS, pids, (half + 1) * sizeof(PageId));
+  memcpy(buffer + NONLEAF_COUNTS, counts, (half + 1) * sizeof(int));
   return 0;
 }
 
 void BTNonLeafNode::locate(int searchKey, int& eid)
 {
-  int count = getKeyCount(), key, i;
-  char *ptr = buffer + sizeof(int) + sizeof(PageId);
-  for (i = 0; i < count; i++, ptr += ENTRY_SIZE) {
-    memcpy(&key, ptr, sizeof(int));
-    if (key > searchKey) break;
-  }
-  eid = i;
+  int count = getKeyCount();
+
+  // stay within the page even if a writer changes the node (see BTLeafNode::locate)
+  if (count < 0 || count > KEYS_PER_PAGE) count = 0;
+  eid = upperBound(data + NONLEAF_KEYS, count, searchKey);
 }
 
 /*
@@ -334,53 +563,81 @@ void BTNonLeafNode::locate(int searchKey, int& eid)
  */
 void BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid)
 {
-  int count = getKeyCount(), key, i;
-  char *ptr = buffer + sizeof(int) + sizeof(PageId);
-  for (i = 0; i < count; i++, ptr += ENTRY_SIZE) {
-    memcpy(&key, ptr, sizeof(int));
-    if (key == searchKey) {
-      memcpy(&pid, ptr + sizeof(int), sizeof(PageId));
-      return;
-    }
-    if (key > searchKey) break;
-  }
-  memcpy(&pid, ptr - sizeof(PageId), sizeof(PageId));
+  int eid;
+
+  // follow the pointer right after the last key <= searchKey
+  locate(searchKey, eid);
+  memcpy(&pid, data + NONLEAF_PIDS + eid*sizeof(PageId), sizeof(PageId));
+}
+
+/*
+ * Find the child holding the last entries smaller than searchKey (or
+ * smaller than or equal to searchKey if orEqual is set), and count the
+ * entries under the children in front of it.
+ * @param searchKey[IN] the key to compare with
+ * @param orEqual[IN] whether the entries with searchKey are counted
+ * @param pid[OUT] the child node to follow
+ * @param before[OUT] the number of entries under the children before pid
+ */
+void BTNonLeafNode::locateRank(int searchKey, bool orEqual, int& eid, PageId& pid, int& before)
+{
+  int count = getKeyCount();
+
+  if (count < 0 || count > KEYS_PER_PAGE) count = 0;
+
+  // the entries of a child lie between the keys around it, and may be
+  // equal to either key. the children in front of the first key that is
+  // not below searchKey hold only entries to count
+  if (orEqual)
+    eid = upperBound(data + NONLEAF_KEYS, count, searchKey);
+  else
+    eid = lowerBound(data + NONLEAF_KEYS, count, searchKey);
+
+  before = 0;
+  for (int i = 0; i < eid; i++)
+    before += getChildEntries(i);
+  memcpy(&pid, data + NONLEAF_PIDS + eid*sizeof(PageId), sizeof(PageId));
 }
 
 /*
  * Initialize the root node with (pid1, key, pid2).
  * @param pid1[IN] the first PageId to insert
+ * @param entries1[IN] the number of leaf entries under pid1
  * @param key[IN] the key that should be inserted between the two PageIds
  * @param pid2[IN] the PageId to insert behind the key
+ * @param entries2[IN] the number of leaf entries under pid2
  */
-void BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2)
+void BTNonLeafNode::initializeRoot(PageId pid1, int entries1, int key, PageId pid2, int entries2)
 {
   int n = 1;
+  char *buffer = writable();
   memcpy(buffer, &n, sizeof(int));
-  memcpy(buffer + sizeof(int), &pid1, sizeof(PageId));
-  memcpy(buffer + sizeof(int) + sizeof(PageId), &key, sizeof(int));
-  memcpy(buffer + sizeof(int)*2 + sizeof(PageId), &pid2, sizeof(PageId));
+  memcpy(buffer + NONLEAF_KEYS, &key, sizeof(int));
+  memcpy(buffer + NONLEAF_PIDS, &pid1, sizeof(PageId));
+  memcpy(buffer + NONLEAF_PIDS + sizeof(PageId), &pid2, sizeof(PageId));
+  memcpy(buffer + NONLEAF_COUNTS, &entries1, sizeof(int));
+  memcpy(buffer + NONLEAF_COUNTS + sizeof(int), &entries2, sizeof(int));
 }
 
-RC BTNonLeafNode::splitFromSibling(int count, PageId sibPid1, char *data, int dsize) {
+RC BTNonLeafNode::splitFromSibling(int count, const int* keys, const PageId* pids, const int* entries) {
   if (getKeyCount() > 0)
     return -1;
+  char *buffer = writable();
   memcpy(buffer, &count, sizeof(int));
-  memcpy(buffer + sizeof(int), &sibPid1, sizeof(PageId));
-  memcpy(buffer + sizeof(int) + sizeof(PageId), data, dsize);
+  memcpy(buffer + NONLEAF_KEYS, keys, count * sizeof(int));
+  memcpy(buffer + NONLEAF_PIDS, pids, (count + 1) * sizeof(PageId));
+  memcpy(buffer + NONLEAF_COUNTS, entries, (count + 1) * sizeof(int));
   return 0;
 }
 
 void BTNonLeafNode::printKeys() {
   int count = getKeyCount(), key;
   PageId pid;
-  char *ptr = buffer + sizeof(int);
-  memcpy(&pid, ptr, sizeof(PageId));
-  ptr += sizeof(PageId);
+  memcpy(&pid, data + NONLEAF_PIDS, sizeof(PageId));
   cout << pid << " ";
-  for (int i = 0; i < count; i++, ptr += ENTRY_SIZE) {
-    memcpy(&key, ptr, sizeof(int));
-    memcpy(&pid, ptr + sizeof(int), sizeof(PageId));
+  for (int i = 0; i < count; i++) {
+    memcpy(&key, data + NONLEAF_KEYS + i*sizeof(int), sizeof(int));
+    memcpy(&pid, data + NONLEAF_PIDS + (i + 1)*sizeof(PageId), sizeof(PageId));
     cout << key << "," << pid << " ";
   }
   cout << endl;
@@ -389,9 +646,8 @@ void BTNonLeafNode::printKeys() {
 void BTNonLeafNode::getChildPtrs(vector<PageId>& ptrs) {
   int count = getKeyCount();
   PageId pid;
-  char *ptr = buffer + sizeof(int);
-  for (int i = 0; i <= count; i++, ptr += ENTRY_SIZE) {
-    memcpy(&pid, ptr, sizeof(PageId));
+  for (int i = 0; i <= count; i++) {
+    memcpy(&pid, data + NONLEAF_PIDS + i*sizeof(PageId), sizeof(PageId));
     ptrs.push_back(pid);
   }
 }
\ No newline at end of file
@@ -25,21 +25,36 @@ class BTLeafNode {
     // number of maximum entries per node
     static const int ENTRIES_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int) - sizeof(PageId)) / ENTRY_SIZE;
     // The first four bytes are used to store # recordIds in the node
-    // and the last four are for Id of the next node
+    // and the last four are for Id of the next node.
+    // In between, the keys of all entries are stored contiguously,
+    // followed by the RecordIds of all entries and then by a fixed number
+    // of value bytes per entry, if the leaf keeps any. A leaf that keeps
+    // values has room for fewer than ENTRIES_PER_PAGE entries.
 	
    /*
     * Constructor
+    * @param valueSize[IN] the number of bytes of the value column kept
+    *                      with each entry (0 for none)
 	*/
-    BTLeafNode();
+    BTLeafNode(int valueSize = 0);
+
+   /**
+    * Return the maximum number of entries of a leaf keeping valueSize
+    * bytes of the value column with each entry.
+    * @param valueSize[IN] the number of value bytes of an entry
+    * @return the number of entries that fit in a page
+    */
+    static int entriesPerPage(int valueSize);
     
    /**
     * Insert the (key, rid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert
     * @param rid[IN] the RecordId to insert
+    * @param value[IN] the value bytes of the entry (zeros if NULL)
     * @return 0 if successful. Return an error code if the node is full.
     */
-    RC insert(int key, const RecordId& rid);
+    RC insert(int key, const RecordId& rid, const char* value = NULL);
 
    /**
     * Insert the (key, rid) pair to the node
@@ -50,9 +65,11 @@ class BTLeafNode {
     * @param rid[IN] the RecordId to insert.
     * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
     * @param siblingKey[OUT] the first key in the sibling node after split.
+    * @param value[IN] the value bytes of the entry (zeros if NULL)
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC insertAndSplit(int key, const RecordId& rid, BTLeafNode& sibling, int& siblingKey);
+    RC insertAndSplit(int key, const RecordId& rid, BTLeafNode& sibling, int& siblingKey,
+                      const char* value = NULL);
 
    /**
     * If searchKey exists in the node, set eid to the index entry
@@ -76,7 +93,35 @@ class BTLeafNode {
     */
     RC readEntry(int eid, int& key, RecordId& rid);
 
-    RC splitFromSibling(int count, char *copy);
+   /**
+    * Copy all (key, rid) pairs of the node, in key order.
+    * @param keys[OUT] room for ENTRIES_PER_PAGE keys
+    * @param rids[OUT] room for ENTRIES_PER_PAGE RecordIds
+    * @param values[OUT] room for PageFile::PAGE_SIZE bytes, which receive
+    *                    the value bytes of the entries one after another.
+    *                    not copied if NULL
+    * @return the number of entries copied
+    */
+    int readEntries(int* keys, RecordId* rids, char* values = NULL);
+
+   /**
+    * Return the number of entries whose key is smaller than searchKey,
+    * or smaller than or equal to searchKey if orEqual is set.
+    * @param searchKey[IN] the key to compare with
+    * @param orEqual[IN] whether the entries with searchKey are counted
+    * @return the number of entries
+    */
+    int countBelow(int searchKey, bool orEqual);
+
+   /**
+    * Fill an EMPTY node with count entries split off from a sibling.
+    * @param count[IN] the number of entries
+    * @param keys[IN] the keys of the entries
+    * @param rids[IN] the RecordIds of the entries
+    * @param values[IN] the value bytes of the entries (zeros if NULL)
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC splitFromSibling(int count, const int* keys, const RecordId* rids, const char* values = NULL);
     
    /**
     * Return the pid of the next slibling node.
@@ -99,6 +144,8 @@ class BTLeafNode {
  
    /**
     * Read the content of the node from the page pid in the PageFile pf.
+    * The page is pinned, not copied, until the node is modified,
+    * read again or destroyed.
     * @param pid[IN] the PageId to read
     * @param pf[IN] PageFile to read from
     * @return 0 if successful. Return an error code if there is an error.
@@ -113,10 +160,44 @@ class BTLeafNode {
     */
     RC write(PageId pid, PageFile& pf);
 
+   /*
+    * Destructor. Unpins the page the node was read from.
+    */
+    ~BTLeafNode();
+
   private:
+    BTLeafNode(const BTLeafNode&);            // nodes are not copyable
+    BTLeafNode& operator=(const BTLeafNode&);
+
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * Return the buffer for modifying the node, copying the pinned page
+    * into it on the first modification after read().
+    */
+    char* writable();
+
+   /**
+    * Unpin the page the node was read from, if any.
+    */
+    void release();
+
+    int valueSize;   // # value bytes kept with each entry
+    int maxEntries;  // # entries that fit in the node
+    int ridOffset;   // the byte offset of the RecordId array in the page
+    int valueOffset; // the byte offset of the value array in the page
+
+   /**
+    * The content of the node. Points to the pinned page after read() and
+    * to buffer once the node has been modified.
+    */
+    const char* data;
+
+   /**
+    * The PageFile the page pointed to by data is pinned in (NULL if none).
+    */
+    const PageFile* pinned;
+
+   /**
+    * The main memory buffer holding the content of a modified node.
     */
     char buffer[PageFile::PAGE_SIZE];
 }; 
@@ -127,10 +208,13 @@ class BTLeafNode {
  */
 class BTNonLeafNode {
   public:
-    static const int ENTRY_SIZE = sizeof(PageId) + sizeof(int);    
+    static const int ENTRY_SIZE = sizeof(PageId) + sizeof(int) + sizeof(int);    
     // number of maximum entries per node
-    static const int KEYS_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int) - sizeof(PageId)) / ENTRY_SIZE;
-    // The first four bytes are used to store # recordIds in the node
+    static const int KEYS_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int) - sizeof(PageId) - sizeof(int)) / ENTRY_SIZE;
+    // The first four bytes are used to store # recordIds in the node.
+    // They are followed by room for KEYS_PER_PAGE keys stored contiguously,
+    // then by the KEYS_PER_PAGE + 1 child PageIds, and then by the number
+    // of leaf entries under each child.
   
    /*
     * Constructor
@@ -142,9 +226,10 @@ class BTNonLeafNode {
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert
     * @param pid[IN] the PageId to insert
+    * @param entries[IN] the number of leaf entries under pid
     * @return 0 if successful. Return an error code if the node is full.
     */
-    RC insert(int key, PageId pid);
+    RC insert(int key, PageId pid, int entries);
 
    /**
     * Insert the (key, pid) pair to the node
@@ -154,11 +239,12 @@ class BTNonLeafNode {
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert
     * @param pid[IN] the PageId to insert
+    * @param entries[IN] the number of leaf entries under pid
     * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
     * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey);
+    RC insertAndSplit(int key, PageId pid, int entries, BTNonLeafNode& sibling, int& midKey);
 
     void locate(int searchKey, int& eid);
     
@@ -171,15 +257,37 @@ class BTNonLeafNode {
     */
     void locateChildPtr(int searchKey, PageId& pid);
 
+   /**
+    * Find the child holding the last entries smaller than searchKey (or
+    * smaller than or equal to searchKey if orEqual is set), and count the
+    * entries under the children in front of it.
+    * @param searchKey[IN] the key to compare with
+    * @param orEqual[IN] whether the entries with searchKey are counted
+    * @param eid[OUT] the child number of the child node to follow
+    * @param pid[OUT] the child node to follow
+    * @param before[OUT] the number of entries under the children before pid
+    */
+    void locateRank(int searchKey, bool orEqual, int& eid, PageId& pid, int& before);
+
    /**
     * Initialize the root node with (pid1, key, pid2).
     * @param pid1[IN] the first PageId to insert
+    * @param entries1[IN] the number of leaf entries under pid1
     * @param key[IN] the key that should be inserted between the two PageIds
     * @param pid2[IN] the PageId to insert behind the key
+    * @param entries2[IN] the number of leaf entries under pid2
     */
-    void initializeRoot(PageId pid1, int key, PageId pid2);
+    void initializeRoot(PageId pid1, int entries1, int key, PageId pid2, int entries2);
 
-    RC splitFromSibling(int count, PageId sibPid1, char *data, int dsize);
+   /**
+    * Fill an EMPTY node with count keys split off from a sibling.
+    * @param count[IN] the number of keys
+    * @param keys[IN] the keys
+    * @param pids[IN] the count + 1 child PageIds around the keys
+    * @param entries[IN] the number of leaf entries under each child
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC splitFromSibling(int count, const int* keys, const PageId* pids, const int* entries);
     
    /**
     * Return the number of keys stored in the node.
@@ -187,13 +295,56 @@ class BTNonLeafNode {
     */
     int getKeyCount();
 
+   /**
+    * Return the total number of leaf entries under the node.
+    * @return the sum of the entry counts of the children
+    */
+    int getEntryCount();
+
+   /**
+    * Return the number of leaf entries under the eid'th child.
+    * @param eid[IN] the child number, from 0 to getKeyCount()
+    * @return the number of entries under the child
+    */
+    int getChildEntries(int eid);
+
+   /**
+    * Return the eid'th child PageId.
+    * @param eid[IN] the child number, from 0 to getKeyCount()
+    * @return the PageId of the child
+    */
+    PageId getChildPtr(int eid);
+
+   /**
+    * Set the number of leaf entries under the eid'th child.
+    * @param eid[IN] the child number, from 0 to getKeyCount()
+    * @param entries[IN] the number of entries under the child
+    */
+    void setChildEntries(int eid, int entries);
+
    /**
     * Read the content of the node from the page pid in the PageFile pf.
+    * The page is pinned, not copied, until the node is modified,
+    * read again or destroyed.
     * @param pid[IN] the PageId to read
     * @param pf[IN] PageFile to read from
     * @return 0 if successful. Return an error code if there is an error.
     */
     RC read(PageId pid, const PageFile& pf);
+
+   /**
+    * Use a copy of a node page kept in memory as the content of the node.
+    * The page is not copied until the node is modified, so it must not
+    * change or go away while the node is used.
+    * @param page[IN] the node page
+    */
+    void attach(const char* page);
+
+   /**
+    * Copy the content of the node to a page in memory.
+    * @param page[OUT] the buffer of PageFile::PAGE_SIZE bytes to copy to
+    */
+    void copyTo(char* page);
     
    /**
     * Write the content of the node to the page pid in the PageFile pf.
@@ -206,10 +357,39 @@ class BTNonLeafNode {
 	void printKeys();
 	void getChildPtrs(std::vector<PageId>& ptrs);
 
+   /*
+    * Destructor. Unpins the page the node was read from.
+    */
+    ~BTNonLeafNode();
+
   private:
+    BTNonLeafNode(const BTNonLeafNode&);      // nodes are not copyable
+    BTNonLeafNode& operator=(const BTNonLeafNode&);
+
+   /**
+    * Return the buffer for modifying the node, copying the pinned page
+    * into it on the first modification after read().
+    */
+    char* writable();
+
+   /**
+    * Unpin the page the node was read from, if any.
+    */
+    void release();
+
+   /**
+    * The content of the node. Points to the pinned page after read() and
+    * to buffer once the node has been modified.
+    */
+    const char* data;
+
+   /**
+    * The PageFile the page pointed to by data is pinned in (NULL if none).
+    */
+    const PageFile* pinned;
+
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * The main memory buffer holding the content of a modified node.
     */
     char buffer[PageFile::PAGE_SIZE];
 }; 
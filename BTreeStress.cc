@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+/*
+ * a stress test and benchmark of concurrent B+tree inserts and lookups.
+ * writer threads insert disjoint sets of keys into a new index while
+ * reader threads look keys up and scan the entries that follow them,
+ * checking that they come in key order. every inserted entry must then
+ * be found and counted, also once the index is opened again. the
+ * throughput of the inserts and lookups is printed.
+ *
+ * build with "make btreestress".
+ * usage: btreestress [writers [readers [inserts per writer]]]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <pthread.h>
+#include <sys/time.h>
+#include "BTreeIndex.h"
+
+using namespace std;
+
+static const char* INDEX_FILE = "btreestress.idx";
+
+// # entries a reader reads after each key it looks up
+static const int ENTRIES_READ = 16;
+
+typedef struct {
+  BTreeIndex*   tree;
+  int           id;       // the thread number among the writers or readers
+  int           writers;  // # writer threads
+  int           inserts;  // # keys inserted by each writer
+  volatile int* stop;     // set once the writers are done
+  long          lookups;  // # lookups done by a reader
+  RC            rc;       // the first error found by the thread
+} Worker;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// the key inserted as the n-th one. multiplying by an odd number is
+// one-to-one modulo 2^31, so every key is distinct and they come in
+// no particular order
+static int keyOf(unsigned n)
+{
+  return (int) ((n * 2654435761u) & 0x7fffffff);
+}
+
+static void* insertKeys(void* arg)
+{
+  Worker* w = (Worker*) arg;
+
+  for (int i = 0; i < w->inserts && w->rc == 0; i++) {
+    int key = keyOf((unsigned) i * w->writers + w->id);
+    RecordId rid = { key, w->id };
+    w->rc = w->tree->insert(key, rid);
+  }
+  return NULL;
+}
+
+// look a key up and check that the entries from it on are in key order
+static RC lookupKey(BTreeIndex* tree, int searchKey)
+{
+  IndexCursor cursor;
+  BTreeScan   scan;
+  int         key, prev = searchKey;
+  RecordId    rid;
+
+  RC rc = tree->locate(searchKey, cursor);
+  if (rc != 0 && rc != RC_NO_SUCH_RECORD && rc != RC_END_OF_TREE) return rc;
+
+  if ((rc = scan.open(*tree, searchKey)) < 0) return rc;
+  for (int i = 0; i < ENTRIES_READ && scan.next(key, rid) == 0; i++) {
+    if (key < prev || rid.pid != key) return RC_INVALID_RID;
+    prev = key;
+  }
+  return 0;
+}
+
+static void* lookupKeys(void* arg)
+{
+  Worker*  w = (Worker*) arg;
+  unsigned seed = w->id + 1;
+
+  // look keys up until the writers are done, or a fixed number of them
+  // if there is no writer
+  while (w->rc == 0 && (w->stop ? !*w->stop : w->lookups < w->inserts)) {
+    w->rc = lookupKey(w->tree, rand_r(&seed) & 0x7fffffff);
+    w->lookups++;
+  }
+  return NULL;
+}
+
+// run the writers and readers and return the first error they found
+static RC runWorkers(vector<Worker>& writers, vector<Worker>& readers, volatile int* stop)
+{
+  vector<pthread_t> wt(writers.size()), rt(readers.size());
+  RC rc = 0;
+
+  for (unsigned i = 0; i < readers.size(); i++)
+    pthread_create(&rt[i], NULL, lookupKeys, &readers[i]);
+  for (unsigned i = 0; i < writers.size(); i++)
+    pthread_create(&wt[i], NULL, insertKeys, &writers[i]);
+
+  for (unsigned i = 0; i < writers.size(); i++) {
+    pthread_join(wt[i], NULL);
+    if (rc == 0) rc = writers[i].rc;
+  }
+  if (stop) *stop = 1;
+  for (unsigned i = 0; i < readers.size(); i++) {
+    pthread_join(rt[i], NULL);
+    if (rc == 0) rc = readers[i].rc;
+  }
+  return rc;
+}
+
+// check that the entries counted in a few ranges are those inserted
+static RC checkCounts(BTreeIndex& tree, int writers, int inserts)
+{
+  const int RANGES = 8;
+  int       expected[RANGES] = { 0 }, count;
+  RC        rc;
+
+  for (long n = 0; n < (long) writers * inserts; n++)
+    expected[keyOf(n) / (0x7fffffff / RANGES + 1)]++;
+
+  for (int i = 0; i < RANGES; i++) {
+    int lo = i * (0x7fffffff / RANGES + 1);
+    if ((rc = tree.countRange(lo, lo + 0x7fffffff / RANGES, count)) < 0) return rc;
+    if (count != expected[i]) return RC_INVALID_FILE_FORMAT;
+  }
+  return 0;
+}
+
+// check that every key inserted is found with its RecordId
+static RC checkKeys(BTreeIndex& tree, int writers, int inserts)
+{
+  IndexCursor cursor;
+  int         key;
+  RecordId    rid;
+  RC          rc;
+
+  for (int id = 0; id < writers; id++) {
+    for (int i = 0; i < inserts; i++) {
+      int expected = keyOf((unsigned) i * writers + id);
+      if ((rc = tree.locate(expected, cursor)) < 0) return rc;
+      if ((rc = tree.readForward(cursor, key, rid)) < 0) return rc;
+      if (key != expected || rid.pid != key || rid.sid != id) return RC_NO_SUCH_RECORD;
+    }
+  }
+
+  // no other entry is in the index
+  long count = 0;
+  rc = tree.locate(0, cursor);
+  if (rc < 0 && rc != RC_NO_SUCH_RECORD && rc != RC_END_OF_TREE) return rc;
+  while (rc != RC_END_OF_TREE && tree.readForward(cursor, key, rid) == 0) count++;
+  if (count != (long) writers * inserts) return RC_INVALID_FILE_FORMAT;
+
+  return checkCounts(tree, writers, inserts);
+}
+
+int main(int argc, char* argv[])
+{
+  int writers = (argc > 1) ? atoi(argv[1]) : 4;
+  int readers = (argc > 2) ? atoi(argv[2]) : 4;
+  int inserts = (argc > 3) ? atoi(argv[3]) : 100000;
+
+  BTreeIndex   tree;
+  volatile int stop = 0;
+  double       start, elapsed;
+  long         lookups;
+  RC           rc;
+
+  if (writers < 0 || readers < 0 || inserts <= 0) {
+    fprintf(stderr, "usage: %s [writers [readers [inserts per writer]]]\n", argv[0]);
+    return 1;
+  }
+
+  remove(INDEX_FILE);
+  if ((rc = tree.open(INDEX_FILE, 'w')) < 0) {
+    fprintf(stderr, "Error: cannot create %s\n", INDEX_FILE);
+    return 1;
+  }
+
+  vector<Worker> w(writers), r(readers);
+  for (int i = 0; i < writers; i++) {
+    Worker worker = { &tree, i, writers, inserts, &stop, 0, 0 };
+    w[i] = worker;
+  }
+  for (int i = 0; i < readers; i++) {
+    Worker worker = { &tree, i, writers, inserts, &stop, 0, 0 };
+    r[i] = worker;
+  }
+
+  // insert with readers running alongside
+  start = now();
+  rc = runWorkers(w, r, &stop);
+  elapsed = now() - start;
+  if (rc < 0) {
+    fprintf(stderr, "Error %d while inserting\n", rc);
+    goto exit_error;
+  }
+  lookups = 0;
+  for (int i = 0; i < readers; i++) lookups += r[i].lookups;
+  fprintf(stdout, "%d writers, %d readers: %.0f inserts/s, %.0f lookups/s\n",
+          writers, readers, (double) writers * inserts / elapsed, lookups / elapsed);
+
+  if ((rc = checkKeys(tree, writers, inserts)) < 0) {
+    fprintf(stderr, "Error %d: an inserted entry is missing or misplaced\n", rc);
+    goto exit_error;
+  }
+
+  // look up with no writer
+  if (readers > 0) {
+    vector<Worker> none;
+    for (int i = 0; i < readers; i++) {
+      r[i].stop = NULL;
+      r[i].lookups = 0;
+    }
+    start = now();
+    rc = runWorkers(none, r, NULL);
+    elapsed = now() - start;
+    if (rc < 0) {
+      fprintf(stderr, "Error %d while looking up\n", rc);
+      goto exit_error;
+    }
+    fprintf(stdout, "%d readers alone: %.0f lookups/s\n",
+            readers, (double) readers * inserts / elapsed);
+  }
+
+  // the counts must be kept when the index is closed
+  if (tree.close() < 0 || tree.open(INDEX_FILE, 'r') < 0 ||
+      (rc = checkCounts(tree, writers, inserts)) < 0) {
+    fprintf(stderr, "Error: the entries are miscounted once the index is opened again\n");
+    goto exit_error;
+  }
+
+  tree.close();
+  remove(INDEX_FILE);
+  fprintf(stdout, "OK\n");
+  return 0;
+
+  exit_error:
+  tree.close();
+  remove(INDEX_FILE);
+  return 1;
+}
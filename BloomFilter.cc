@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#include "BloomFilter.h"
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+// # bits in a page of the filter
+static const unsigned PAGE_BITS = PageFile::PAGE_SIZE * 8;
+
+// mix the bits of a hash, so that every bit depends on all of them
+static unsigned mix(unsigned h)
+{
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+// the i-th bit of an entry in its page. the bits are spread by double
+// hashing on a hash independent of the page number
+static unsigned bitOf(unsigned hash, int i)
+{
+  unsigned a = mix(hash ^ 0x9e3779b9);
+  unsigned b = ((a >> 16) | (a << 16)) | 1;
+  return (a + i * b) % PAGE_BITS;
+}
+
+BloomFilter::BloomFilter()
+: fileMode('r'), fileOpen(false), pages(0)
+{
+}
+
+RC BloomFilter::open(const string& filename, char mode)
+{
+  RC rc;
+  if ((rc = pf.open(filename, mode)) < 0)
+    return rc;
+  fileMode = mode;
+  fileOpen = true;
+  pages = pf.endPid();
+  bits.assign((size_t) pages * PageFile::PAGE_SIZE, 0);
+  loaded.assign(pages, 0);
+
+  // lookups read a page at random under 'r' mode
+  if (mode == 'r' || mode == 'R') {
+    pf.advise(PageFile::ACCESS_RANDOM);
+    return 0;
+  }
+
+  // the whole filter is changed in memory under 'w' mode
+  for (int pid = 0; pid < pages; pid++) {
+    if ((rc = pf.read(pid, &bits[(size_t) pid * PageFile::PAGE_SIZE])) < 0) {
+      fileOpen = false;
+      pf.close();
+      close();
+      return rc;
+    }
+    loaded[pid] = 1;
+  }
+  return 0;
+}
+
+RC BloomFilter::close()
+{
+  RC rc = closeFile();
+
+  pages = 0;
+  bits.clear();
+  loaded.clear();
+  return rc;
+}
+
+RC BloomFilter::closeFile()
+{
+  RC rc = 0;
+
+  if (!fileOpen)
+    return 0;
+  if (fileMode == 'w' || fileMode == 'W') {
+    for (int pid = 0; pid < pages && rc == 0; pid++)
+      rc = pf.write(pid, &bits[(size_t) pid * PageFile::PAGE_SIZE]);
+  }
+  fileOpen = false;
+
+  if (rc < 0) {
+    pf.close();
+    return rc;
+  }
+  return pf.close();
+}
+
+int BloomFilter::capacity() const
+{
+  return (int) ((long) pages * PAGE_BITS / BITS_PER_ENTRY);
+}
+
+int BloomFilter::entries() const
+{
+  long set = 0;
+
+  for (size_t i = 0; i < bits.size(); i++)
+    for (unsigned char byte = bits[i]; byte != 0; byte &= byte - 1)
+      set++;
+  if (set == 0)
+    return 0;
+
+  // every entry sets HASH_COUNT bits at random in its page, so the
+  // fraction of bits still clear is about exp(-HASH_COUNT * n / m)
+  double m = (double) pages * PAGE_BITS;
+  if (set >= m)
+    return INT_MAX;
+  return (int) ceil(-m / HASH_COUNT * log(1.0 - set / m));
+}
+
+void BloomFilter::resize(int entries)
+{
+  // a filter cannot shrink, since its file keeps its size
+  int size = (int) (((long) entries * BITS_PER_ENTRY + PAGE_BITS - 1) / PAGE_BITS);
+  if (size < 1) size = 1;
+  if (size < pf.endPid()) size = pf.endPid();
+
+  pages = size;
+  bits.assign((size_t) pages * PageFile::PAGE_SIZE, 0);
+  loaded.assign(pages, 1);
+}
+
+void BloomFilter::add(unsigned hash)
+{
+  if (pages == 0) return;
+
+  char* page = &bits[(size_t) (hash % pages) * PageFile::PAGE_SIZE];
+  for (int i = 0; i < HASH_COUNT; i++) {
+    unsigned bit = bitOf(hash, i);
+    page[bit / 8] |= (char) (1 << (bit % 8));
+  }
+}
+
+bool BloomFilter::mayContain(unsigned hash)
+{
+  if (pages == 0)
+    return true;
+
+  // read the page the first time it is needed
+  PageId pid = hash % pages;
+  char*  page = &bits[(size_t) pid * PageFile::PAGE_SIZE];
+  if (!loaded[pid]) {
+    if (!fileOpen || pf.read(pid, page) < 0)
+      return true;
+    loaded[pid] = 1;
+  }
+
+  for (int i = 0; i < HASH_COUNT; i++) {
+    unsigned bit = bitOf(hash, i);
+    if ((page[bit / 8] & (1 << (bit % 8))) == 0)
+      return false;
+  }
+  return true;
+}
+
+unsigned BloomFilter::hashKey(int key)
+{
+  return mix((unsigned) key);
+}
+
+unsigned BloomFilter::hashValue(const string& value)
+{
+  // FNV-1a, with a different start than the keys
+  unsigned h = 2166136261u;
+  for (unsigned i = 0; i < value.size(); i++) {
+    h ^= (unsigned char) value[i];
+    h *= 16777619u;
+  }
+  return mix(h ^ 0x5bd1e995);
+}
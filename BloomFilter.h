@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#ifndef BLOOMFILTER_H
+#define BLOOMFILTER_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+/**
+ * a Bloom filter of the keys and the values of a table, telling that a
+ * key or a value is not in the table without reading it.
+ *
+ * the filter is blocked: the bits of an entry are all set in one page of
+ * the filter, chosen by its hash, so a lookup reads a single page. the
+ * file holds nothing but these pages, and the number of pages is taken
+ * from the size of the file.
+ *
+ * under 'w' mode, the whole filter is kept in memory and written back by
+ * close(). under 'r' mode, a page is read when a lookup first needs it
+ * and is kept in memory from then on, so a filter kept open answers
+ * lookups without reading any page again.
+ */
+class BloomFilter {
+ public:
+  // # bits of the filter for every entry it is sized for
+  static const int BITS_PER_ENTRY = 10;
+
+  // # bits set for an entry
+  static const int HASH_COUNT = 7;
+
+  BloomFilter();
+
+  /**
+   * open the filter file in read or write mode.
+   * under 'w' mode, the filter file is created if it does not exist.
+   * @param filename[IN] the name of the filter file
+   * @param mode[IN] 'r' for read, 'w' for write
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& filename, char mode);
+
+  /**
+   * close the filter file, writing the filter back under 'w' mode.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * close the filter file, writing the filter back under 'w' mode, but
+   * keep the pages in memory for lookups until close() is called.
+   * @return error code. 0 if no error
+   */
+  RC closeFile();
+
+  /**
+   * @return # entries the filter is sized for. 0 if the filter is empty
+   */
+  int capacity() const;
+
+  /**
+   * estimate # distinct entries added to the filter from # bits set.
+   * 'w' mode only.
+   * @return # entries in the filter, roughly
+   */
+  int entries() const;
+
+  /**
+   * clear the filter and size it for the given # entries. 'w' mode only.
+   * @param entries[IN] # entries to size the filter for
+   */
+  void resize(int entries);
+
+  /**
+   * add an entry to the filter. 'w' mode only.
+   * @param hash[IN] the hash of the entry, from hashKey() or hashValue()
+   */
+  void add(unsigned hash);
+
+  /**
+   * check whether an entry may have been added to the filter.
+   * an empty filter, or one that cannot be read, may contain anything.
+   * @param hash[IN] the hash of the entry, from hashKey() or hashValue()
+   * @return false if the entry has certainly not been added
+   */
+  bool mayContain(unsigned hash);
+
+  /**
+   * @return the hash of a key as an entry of the filter
+   */
+  static unsigned hashKey(int key);
+
+  /**
+   * @return the hash of a value as an entry of the filter
+   */
+  static unsigned hashValue(const std::string& value);
+
+ private:
+  PageFile          pf;       // the PageFile used to store the filter
+  char              fileMode; // the mode the filter file was opened in
+  bool              fileOpen; // true until the filter file is closed
+  int               pages;    // # pages of the filter
+  std::vector<char> bits;     // the filter
+  std::vector<char> loaded;   // whether each page is in bits
+};
+
+#endif /* BLOOMFILTER_H */
@@ -0,0 +1,651 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#include <cstdio>
+#include <algorithm>
+#include "Executor.h"
+
+using namespace std;
+
+// # entries read from an index at a time. the tuples of these entries are
+// fetched from the table together, so they span many table pages
+static const unsigned INDEX_BATCH_SIZE = 1 << 16;
+
+// pass the tuples from pos on to batch, up to BATCH_SIZE of them, and
+// move pos past them. values is empty if the values were not read
+static void passOn(vector<int>& keys, vector<string>& values, unsigned& pos, TupleBatch& batch)
+{
+  unsigned n = min((unsigned) keys.size() - pos, (unsigned) Operator::BATCH_SIZE);
+
+  batch.keys.assign(keys.begin() + pos, keys.begin() + pos + n);
+  batch.values.clear();
+  if (!values.empty()) {
+    batch.values.resize(n);
+    for (unsigned i = 0; i < n; i++)
+      batch.values[i].swap(values[pos + i]);
+  }
+  batch.sel.resize(n);
+  for (unsigned i = 0; i < n; i++)
+    batch.sel[i] = i;
+  pos += n;
+}
+
+// get the values of the index entries, from their packed values if the
+// index keeps them (packed is empty otherwise) and from the table for
+// the rest. the table pages holding the rest are read once each, in
+// ascending order
+static RC fetchValues(const RecordFile& rf, const vector<IndexEntry>& entries, const vector<char>& packed, vector<string>& values)
+{
+  RC               rc;
+  vector<RecordId> rids;     // the records to read from the table
+  vector<unsigned> missing;  // the entries they belong to
+  vector<int>      keys;
+  vector<string>   read;
+
+  values.resize(entries.size());
+  for (unsigned i = 0; i < entries.size(); i++) {
+    if (!packed.empty() && BTreeIndex::unpackValue(&packed[i * INDEX_VALUE_SIZE], values[i]))
+      continue;
+    rids.push_back(entries[i].rid);
+    missing.push_back(i);
+  }
+
+  if ((rc = rf.readBatch(rids, keys, read)) < 0)
+    return rc;
+  for (unsigned i = 0; i < missing.size(); i++)
+    values[missing[i]].swap(read[i]);
+  return 0;
+}
+
+// make batch a single tuple whose key is count
+static void passCount(int count, TupleBatch& batch)
+{
+  batch.keys.assign(1, count);
+  batch.values.clear();
+  batch.sel.assign(1, 0);
+}
+
+TableScan::TableScan(const RecordFile& rf, const ScanBounds& bounds, const Predicate& pred, bool readValues)
+: rf(rf), bounds(bounds), pred(pred), readValues(readValues), done(false)
+{
+}
+
+RC TableScan::open()
+{
+  done = false;
+  rf.advise(PageFile::ACCESS_SEQUENTIAL);
+  return scan.open(rf, bounds);
+}
+
+RC TableScan::next(TupleBatch& batch)
+{
+  RC       rc;
+  RecordId rid;
+
+  batch.keys.clear();
+  batch.values.clear();
+  batch.sel.clear();
+
+  // whole pages are added to the batch until it is full
+  while (!done && batch.keys.size() < (unsigned) BATCH_SIZE) {
+    if ((rc = scan.nextKeys(rid, pageKeys)) < 0) {
+      if (rc != RC_END_OF_FILE)
+        return rc;
+      done = true;
+      break;
+    }
+
+    int n = pageKeys.size();
+    selected.resize(n);
+    if (pred.filterKeys(&pageKeys[0], n, &selected[0]) == 0)
+      continue;
+
+    // the values can be read only while the page is the current one
+    int base = batch.keys.size();
+    batch.keys.insert(batch.keys.end(), pageKeys.begin(), pageKeys.end());
+    if (readValues)
+      batch.values.resize(base + n);
+    for (int i = 0; i < n; i++) {
+      if (!selected[i])
+        continue;
+      batch.sel.push_back(base + i);
+      if (readValues && (rc = scan.readValue(rid.sid + i, batch.values[base + i])) < 0)
+        return rc;
+    }
+  }
+
+  return batch.keys.empty() ? RC_END_OF_FILE : 0;
+}
+
+ParallelScan::ParallelScan(const RecordFile& rf, const ScanBounds& bounds, const Predicate& pred, bool readValues, bool counting, int threads)
+: rf(rf), bounds(bounds), pred(pred), readValues(readValues), counting(counting),
+  threads(max(1, min(threads, (int) MAX_THREADS))), started(0), stopped(false),
+  passed(0), done(false), pos(0)
+{
+  pthread_mutex_init(&latch, NULL);
+  pthread_cond_init(&scanned, NULL);
+  pthread_cond_init(&moved, NULL);
+}
+
+ParallelScan::~ParallelScan()
+{
+  stop();
+  pthread_cond_destroy(&moved);
+  pthread_cond_destroy(&scanned);
+  pthread_mutex_destroy(&latch);
+}
+
+RC ParallelScan::open()
+{
+  stop();
+
+  RecordId end = rf.endRid();
+  int pages = end.pid + (end.sid > 0 ? 1 : 0);
+
+  morsels.clear();
+  morsels.resize((pages + MORSEL_PAGES - 1) / MORSEL_PAGES);
+  for (unsigned m = 0; m < morsels.size(); m++) {
+    morsels[m].count = 0;
+    morsels[m].done = false;
+    morsels[m].rc = 0;
+  }
+
+  // the morsels are dealt round-robin, so that the workers move through
+  // the table together and the morsels are done roughly in order
+  workers.clear();
+  workers.resize(threads);
+  for (int i = 0; i < threads; i++) {
+    workers[i].scan = this;
+    workers[i].id = i;
+  }
+  for (unsigned m = 0; m < morsels.size(); m++)
+    workers[m % threads].morsels.push_back(m);
+
+  stopped = false;
+  passed = 0;
+  done = false;
+  keys.clear();
+  values.clear();
+  pos = 0;
+
+  // the morsels of a worker that cannot be started are stolen by the
+  // others, or scanned by the thread calling next()
+  rf.advise(PageFile::ACCESS_SEQUENTIAL);
+  for (started = 0; started < threads; started++)
+    if (pthread_create(&workers[started].thread, NULL, work, &workers[started]) != 0)
+      break;
+  return 0;
+}
+
+void* ParallelScan::work(void* arg)
+{
+  Worker*       worker = (Worker*) arg;
+  ParallelScan* scan = worker->scan;
+  int           m;
+
+  while ((m = scan->take(worker->id)) >= 0) {
+    RC rc = scan->scanMorsel(m);
+    pthread_mutex_lock(&scan->latch);
+    scan->morsels[m].rc = rc;
+    scan->morsels[m].done = true;
+    pthread_cond_signal(&scan->scanned);
+    pthread_mutex_unlock(&scan->latch);
+  }
+  return NULL;
+}
+
+int ParallelScan::take(int id)
+{
+  int m = -1;
+
+  pthread_mutex_lock(&latch);
+  if (!stopped) {
+    deque<int>& own = workers[id].morsels;
+    if (!own.empty()) {
+      m = own.front();
+      own.pop_front();
+    }
+    else {
+      // steal from the back of the longest deque
+      int victim = id;
+      for (int i = 0; i < threads; i++)
+        if (workers[i].morsels.size() > workers[victim].morsels.size())
+          victim = i;
+      if (!workers[victim].morsels.empty()) {
+        m = workers[victim].morsels.back();
+        workers[victim].morsels.pop_back();
+      }
+    }
+  }
+
+  // the tuples of a morsel are kept until the morsels before it are
+  // passed on. a count keeps none
+  while (m >= 0 && !counting && !stopped && m >= passed + MORSELS_AHEAD * threads)
+    pthread_cond_wait(&moved, &latch);
+  if (stopped)
+    m = -1;
+  pthread_mutex_unlock(&latch);
+  return m;
+}
+
+RC ParallelScan::scanMorsel(int m)
+{
+  RC         rc;
+  RecordScan scan;
+  RecordId   rid;
+  string     value;
+  vector<int>  pageKeys;
+  vector<char> selected;
+  Morsel&    morsel = morsels[m];
+
+  if ((rc = scan.open(rf, bounds, m * MORSEL_PAGES, (m + 1) * MORSEL_PAGES)) < 0)
+    return rc;
+
+  while ((rc = scan.nextKeys(rid, pageKeys)) == 0) {
+    int n = pageKeys.size();
+    selected.resize(n);
+    if (pred.filterKeys(&pageKeys[0], n, &selected[0]) == 0)
+      continue;
+
+    for (int i = 0; i < n; i++) {
+      if (!selected[i])
+        continue;
+      if (readValues) {
+        if ((rc = scan.readValue(rid.sid + i, value)) < 0)
+          return rc;
+        if (!pred.matchValue(value))
+          continue;
+      }
+      morsel.count++;
+      if (!counting) {
+        morsel.keys.push_back(pageKeys[i]);
+        if (readValues)
+          morsel.values.push_back(value);
+      }
+    }
+  }
+  return (rc == RC_END_OF_FILE) ? 0 : rc;
+}
+
+RC ParallelScan::awaitMorsel(int m)
+{
+  RC rc;
+
+  pthread_mutex_lock(&latch);
+
+  // a morsel no worker has taken is still at the front of the deque it
+  // was dealt to, since the morsels before it are done
+  deque<int>& dealt = workers[m % threads].morsels;
+  if (!dealt.empty() && dealt.front() == m) {
+    dealt.pop_front();
+    pthread_mutex_unlock(&latch);
+    rc = scanMorsel(m);
+    pthread_mutex_lock(&latch);
+    morsels[m].rc = rc;
+    morsels[m].done = true;
+  }
+
+  while (!morsels[m].done)
+    pthread_cond_wait(&scanned, &latch);
+  rc = morsels[m].rc;
+  pthread_mutex_unlock(&latch);
+  return rc;
+}
+
+RC ParallelScan::next(TupleBatch& batch)
+{
+  RC rc;
+
+  // the counts of the morsels are added up once all are done
+  if (counting) {
+    int count = 0;
+    if (done)
+      return RC_END_OF_FILE;
+    for (unsigned m = 0; m < morsels.size(); m++) {
+      if ((rc = awaitMorsel(m)) < 0)
+        return rc;
+      count += morsels[m].count;
+    }
+    passCount(count, batch);
+    done = true;
+    return 0;
+  }
+
+  while (pos >= keys.size()) {
+    if (passed == (int) morsels.size())
+      return RC_END_OF_FILE;
+    if ((rc = awaitMorsel(passed)) < 0)
+      return rc;
+
+    // the tuples of the morsel are freed as they are taken
+    keys.clear();
+    values.clear();
+    keys.swap(morsels[passed].keys);
+    values.swap(morsels[passed].values);
+    pos = 0;
+
+    pthread_mutex_lock(&latch);
+    passed++;
+    pthread_cond_broadcast(&moved);
+    pthread_mutex_unlock(&latch);
+  }
+
+  passOn(keys, values, pos, batch);
+  return 0;
+}
+
+void ParallelScan::stop()
+{
+  pthread_mutex_lock(&latch);
+  stopped = true;
+  pthread_cond_broadcast(&moved);
+  pthread_mutex_unlock(&latch);
+
+  for (int i = 0; i < started; i++)
+    pthread_join(workers[i].thread, NULL);
+  started = 0;
+}
+
+IndexScan::IndexScan(const BTreeIndex& tree, const RecordFile& rf, int lo, int hi, bool readValues)
+: tree(tree), rf(rf), lo(lo), hi(hi), readValues(readValues), pos(0)
+{
+}
+
+RC IndexScan::open()
+{
+  keys.clear();
+  values.clear();
+  pos = 0;
+
+  // heap pages are fetched in key order, i.e., at random
+  rf.advise(PageFile::ACCESS_RANDOM);
+  return range.open(tree, lo, hi);
+}
+
+RC IndexScan::next(TupleBatch& batch)
+{
+  RC rc;
+
+  while (pos >= keys.size()) {
+    if ((rc = range.nextBatch(entries, INDEX_BATCH_SIZE, readValues ? &packed : NULL)) < 0)
+      return (rc == RC_END_OF_TREE) ? RC_END_OF_FILE : rc;
+
+    keys.resize(entries.size());
+    for (unsigned i = 0; i < entries.size(); i++)
+      keys[i] = entries[i].key;
+    values.clear();
+    if (readValues && (rc = fetchValues(rf, entries, packed, values)) < 0)
+      return rc;
+    pos = 0;
+  }
+
+  passOn(keys, values, pos, batch);
+  return 0;
+}
+
+ValueIndexScan::ValueIndexScan(const StringIndex& index, const RecordFile& rf, const string& lo, const string* hi, bool valueOnly)
+: index(index), rf(rf), lo(lo), hasHi(hi != NULL), valueOnly(valueOnly), done(false), pos(0)
+{
+  // the index holds the values cut down to their keys
+  if (hi != NULL)
+    this->hi = StringIndex::keyOf(*hi);
+}
+
+RC ValueIndexScan::open()
+{
+  keys.clear();
+  values.clear();
+  pos = 0;
+  done = false;
+
+  // heap pages are fetched in value order, i.e., at random
+  rf.advise(PageFile::ACCESS_RANDOM);
+  return scan.open(index, StringIndex::keyOf(lo));
+}
+
+RC ValueIndexScan::next(TupleBatch& batch)
+{
+  RC               rc = 0;
+  RecordId         rid;
+  string           value;
+  vector<RecordId> rids;     // the records to read from the table
+  vector<unsigned> missing;  // the tuples they belong to
+  vector<int>      readKeys;
+  vector<string>   read;
+
+  while (pos >= keys.size()) {
+    if (done)
+      return RC_END_OF_FILE;
+
+    keys.clear();
+    values.clear();
+    pos = 0;
+    for (unsigned n = 0; n < INDEX_BATCH_SIZE; n++) {
+      if ((rc = scan.next(value, rid)) < 0 || (hasHi && value > hi)) {
+        done = true;
+        break;
+      }
+      if (valueOnly) {
+        // a key of the longest length may be a cut-down value, which
+        // is read from the table
+        if (value.size() == (unsigned) StringIndex::MAX_KEY_LENGTH) {
+          rids.push_back(rid);
+          missing.push_back(values.size());
+        }
+        keys.push_back(0);
+        values.push_back(value);
+      }
+      else {
+        rids.push_back(rid);
+      }
+    }
+    if (rc < 0 && rc != RC_END_OF_TREE)
+      return rc;
+
+    if (!valueOnly) {
+      if ((rc = rf.readBatch(rids, keys, values)) < 0)
+        return rc;
+    }
+    else if (!rids.empty()) {
+      if ((rc = rf.readBatch(rids, readKeys, read)) < 0)
+        return rc;
+      for (unsigned i = 0; i < missing.size(); i++)
+        values[missing[i]].swap(read[i]);
+      missing.clear();
+    }
+    rids.clear();
+  }
+
+  passOn(keys, values, pos, batch);
+  return 0;
+}
+
+HashLookup::HashLookup(const HashIndex& index, const RecordFile& rf, int key, bool readValues)
+: index(index), rf(rf), key(key), readValues(readValues), pos(0)
+{
+}
+
+RC HashLookup::open()
+{
+  RC               rc;
+  vector<RecordId> rids;
+
+  keys.clear();
+  values.clear();
+  pos = 0;
+
+  if ((rc = index.lookup(key, rids)) < 0)
+    return rc;
+
+  // the key is all a plan needs unless the values are read
+  if (!readValues) {
+    keys.assign(rids.size(), key);
+    return 0;
+  }
+  rf.advise(PageFile::ACCESS_RANDOM);
+  return rf.readBatch(rids, keys, values);
+}
+
+RC HashLookup::next(TupleBatch& batch)
+{
+  if (pos >= keys.size())
+    return RC_END_OF_FILE;
+
+  passOn(keys, values, pos, batch);
+  return 0;
+}
+
+IndexCount::IndexCount(const BTreeIndex& tree, int lo, int hi, const vector<int>& excluded)
+: tree(tree), lo(lo), hi(hi), excluded(excluded), done(false)
+{
+  // the same key may be excluded more than once
+  sort(this->excluded.begin(), this->excluded.end());
+  this->excluded.erase(unique(this->excluded.begin(), this->excluded.end()), this->excluded.end());
+}
+
+RC IndexCount::open()
+{
+  done = false;
+  return 0;
+}
+
+RC IndexCount::next(TupleBatch& batch)
+{
+  RC  rc;
+  int count;
+
+  if (done)
+    return RC_END_OF_FILE;
+
+  if ((rc = tree.countRange(lo, hi, count)) < 0)
+    return rc;
+  for (unsigned i = 0; i < excluded.size(); i++) {
+    int n;
+    if (excluded[i] < lo || excluded[i] > hi) continue;
+    if ((rc = tree.countRange(excluded[i], excluded[i], n)) < 0)
+      return rc;
+    count -= n;
+  }
+
+  passCount(count, batch);
+  done = true;
+  return 0;
+}
+
+Filter::Filter(Operator* child, const Predicate& pred)
+: child(child), pred(pred)
+{
+}
+
+Filter::~Filter()
+{
+  delete child;
+}
+
+RC Filter::open()
+{
+  return child->open();
+}
+
+RC Filter::next(TupleBatch& batch)
+{
+  RC   rc;
+  bool checkKey = pred.hasKeyConditions();
+  bool checkValue = pred.hasValueConditions();
+
+  if ((rc = child->next(batch)) < 0)
+    return rc;
+
+  // the selection vector is narrowed in place
+  unsigned n = 0;
+  for (unsigned i = 0; i < batch.sel.size(); i++) {
+    int s = batch.sel[i];
+    if (checkKey && !pred.matchKey(batch.keys[s]))
+      continue;
+    if (checkValue && !pred.matchValue(batch.values[s]))
+      continue;
+    batch.sel[n++] = s;
+  }
+  batch.sel.resize(n);
+  return 0;
+}
+
+Count::Count(Operator* child)
+: child(child), done(false)
+{
+}
+
+Count::~Count()
+{
+  delete child;
+}
+
+RC Count::open()
+{
+  done = false;
+  return child->open();
+}
+
+RC Count::next(TupleBatch& batch)
+{
+  RC  rc;
+  int count = 0;
+
+  if (done)
+    return RC_END_OF_FILE;
+
+  while ((rc = child->next(batch)) == 0)
+    count += batch.sel.size();
+  if (rc != RC_END_OF_FILE)
+    return rc;
+
+  passCount(count, batch);
+  done = true;
+  return 0;
+}
+
+Project::Project(Operator* child, int attr)
+: child(child), attr(attr)
+{
+}
+
+Project::~Project()
+{
+  delete child;
+}
+
+RC Project::open()
+{
+  return child->open();
+}
+
+RC Project::next(TupleBatch& batch)
+{
+  RC rc;
+
+  if ((rc = child->next(batch)) < 0)
+    return rc;
+
+  for (unsigned i = 0; i < batch.sel.size(); i++) {
+    int s = batch.sel[i];
+    switch (attr) {
+    case 1:  // SELECT key
+    case 4:  // SELECT COUNT(*)
+      fprintf(stdout, "%d\n", batch.keys[s]);
+      break;
+    case 2:  // SELECT value
+      fprintf(stdout, "%s\n", batch.values[s].c_str());
+      break;
+    case 3:  // SELECT *
+      fprintf(stdout, "%d '%s'\n", batch.keys[s], batch.values[s].c_str());
+      break;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,366 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <pthread.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "RecordFile.h"
+#include "BTreeIndex.h"
+#include "StringIndex.h"
+#include "HashIndex.h"
+#include "Predicate.h"
+
+/**
+ * a batch of tuples passed from an operator to the next, kept by column.
+ * only the tuples whose positions are in the selection vector sel belong
+ * to the batch. the others were filtered out, and their values may not
+ * have been read.
+ */
+typedef struct {
+  std::vector<int>         keys;   // the keys of the tuples
+  std::vector<std::string> values; // their values. empty if none was read
+  std::vector<int>         sel;    // the positions of the selected tuples
+} TupleBatch;
+
+/**
+ * an operator of a query plan. the operators of a plan form a tree, and
+ * each of them pulls batches of tuples from its child and passes batches
+ * to its parent, so every operator works on a batch at a time rather
+ * than a tuple at a time. an operator owns its child.
+ */
+class Operator {
+ public:
+  // # tuples an operator passes on at a time, roughly. a table scan fills
+  // a batch with whole pages
+  static const int BATCH_SIZE = 1024;
+
+  virtual ~Operator() {}
+
+  /**
+   * prepare the operator and its children for next().
+   * @return error code. 0 if no error
+   */
+  virtual RC open() = 0;
+
+  /**
+   * produce the next batch of tuples. a batch may have no tuple selected.
+   * @param batch[OUT] the batch
+   * @return error code. 0 if no error. RC_END_OF_FILE if no tuple is left
+   */
+  virtual RC next(TupleBatch& batch) = 0;
+};
+
+/**
+ * scan the table, skipping the extents out of bounds by the zone map.
+ * the keys of a page are checked all at once against the conditions on
+ * key, and only the values of the tuples selected are decoded.
+ */
+class TableScan : public Operator {
+ public:
+  /**
+   * @param rf[IN] the table. it must stay open during the scan
+   * @param bounds[IN] the tuples looked for
+   * @param pred[IN] the conditions on key, checked in the scan
+   * @param readValues[IN] true if the values are needed
+   */
+  TableScan(const RecordFile& rf, const ScanBounds& bounds, const Predicate& pred, bool readValues);
+
+  RC open();
+  RC next(TupleBatch& batch);
+
+ private:
+  const RecordFile& rf;
+  RecordScan        scan;
+  ScanBounds        bounds;
+  Predicate         pred;
+  bool              readValues;
+  bool              done;      // true once the table has been read
+  std::vector<int>  pageKeys;  // the keys of the current page
+  std::vector<char> selected;  // which of them meet the conditions
+};
+
+/**
+ * scan the table with several threads. the pages are split into morsels
+ * of MORSEL_PAGES pages, dealt round-robin to the deques of the workers.
+ * a worker takes the morsels of its own deque from the front and, once
+ * it runs out, steals from the back of the longest deque of the others.
+ * every worker checks the conditions and counts the tuples of a morsel
+ * on its own. the tuples selected are passed on in the order of their
+ * morsels, as a TableScan would, or only their count if the scan counts.
+ */
+class ParallelScan : public Operator {
+ public:
+  // # pages of a morsel, a whole number of zone map extents
+  static const int MORSEL_PAGES = 8 * RecordFile::ZONE_PAGES;
+
+  // # morsels a worker may run ahead of the ones passed on, per worker,
+  // so that the tuples waiting to be passed on are bounded
+  static const int MORSELS_AHEAD = 4;
+
+  // # worker threads at most
+  static const int MAX_THREADS = 64;
+
+  /**
+   * @param rf[IN] the table. it must stay open during the scan
+   * @param bounds[IN] the tuples looked for
+   * @param pred[IN] the conditions, checked in the scan
+   * @param readValues[IN] true if the values are needed
+   * @param counting[IN] true if the count of the tuples is passed on, as
+   *                     the key of a single tuple, in place of the tuples
+   * @param threads[IN] # worker threads
+   */
+  ParallelScan(const RecordFile& rf, const ScanBounds& bounds, const Predicate& pred, bool readValues, bool counting, int threads);
+  ~ParallelScan();
+
+  RC open();
+  RC next(TupleBatch& batch);
+
+ private:
+  ParallelScan(const ParallelScan&);            // scans are not copyable
+  ParallelScan& operator=(const ParallelScan&);
+
+  // the tuples a worker selected from a morsel
+  typedef struct {
+    std::vector<int>         keys;
+    std::vector<std::string> values;
+    int  count;  // # tuples selected
+    bool done;   // true once the morsel has been scanned
+    RC   rc;     // the error of the scan, if any
+  } Morsel;
+
+  typedef struct {
+    ParallelScan*   scan;
+    int             id;
+    pthread_t       thread;
+    std::deque<int> morsels; // the morsels left to the worker, in order
+  } Worker;
+
+  // the loop of a worker thread
+  static void* work(void* arg);
+
+  // take the next morsel for worker id, waiting until it may run that far
+  // ahead. -1 if no morsel is left or the scan is stopped
+  int take(int id);
+
+  // check the conditions on the tuples of morsel m
+  RC scanMorsel(int m);
+
+  // wait until morsel m is done, scanning it in the calling thread if no
+  // worker has taken it. the morsels before m must be done
+  RC awaitMorsel(int m);
+
+  // stop the workers and wait for them to finish
+  void stop();
+
+  const RecordFile&   rf;
+  ScanBounds          bounds;
+  Predicate           pred;
+  bool                readValues;
+  bool                counting;
+  int                 threads;
+  std::vector<Morsel> morsels;
+  std::vector<Worker> workers;
+  int                 started;  // # worker threads running
+  bool                stopped;  // true if the workers are to stop
+  int                 passed;   // # morsels passed on
+  bool                done;     // true once the count has been passed on
+  std::vector<int>         keys;   // the tuples of the morsel being
+  std::vector<std::string> values; //   passed on
+  unsigned                 pos;    // the first tuple not passed on yet
+  pthread_mutex_t     latch;    // guards the deques, morsels and passed
+  pthread_cond_t      scanned;  // signaled when a morsel is done
+  pthread_cond_t      moved;    // signaled when passed grows or on stop
+};
+
+/**
+ * scan the entries of the B+tree index with a key in [lo, hi]. the
+ * tuples of many entries are fetched from the table together, in the
+ * order of their table pages, unless the index keeps their values.
+ */
+class IndexScan : public Operator {
+ public:
+  /**
+   * @param tree[IN] the index on key. it must stay open during the scan
+   * @param rf[IN] the table. it must stay open during the scan
+   * @param lo[IN] the smallest key to return
+   * @param hi[IN] the largest key to return
+   * @param readValues[IN] true if the values are needed
+   */
+  IndexScan(const BTreeIndex& tree, const RecordFile& rf, int lo, int hi, bool readValues);
+
+  RC open();
+  RC next(TupleBatch& batch);
+
+ private:
+  const BTreeIndex&        tree;
+  const RecordFile&        rf;
+  BTreeScan                range;
+  int                      lo, hi;
+  bool                     readValues;
+  std::vector<IndexEntry>  entries; // the entries read from the index
+  std::vector<char>        packed;  // their values kept by a covering index
+  std::vector<int>         keys;    // the tuples of the entries
+  std::vector<std::string> values;
+  unsigned                 pos;     // the first tuple not passed on yet
+};
+
+/**
+ * scan the entries of the value index with a value from lo on, up to hi
+ * if it is given. the tuples are fetched from the table in batches, in
+ * the order of their table pages, unless the values are all a plan needs.
+ * as the index keeps long values cut down to a prefix, some tuples
+ * beyond lo or hi may be returned, and the caller filters them out.
+ */
+class ValueIndexScan : public Operator {
+ public:
+  /**
+   * @param index[IN] the index on value. it must stay open during the scan
+   * @param rf[IN] the table. it must stay open during the scan
+   * @param lo[IN] the smallest value to return
+   * @param hi[IN] the largest value to return. NULL if there is none
+   * @param valueOnly[IN] true if the keys are not needed. they are left 0
+   */
+  ValueIndexScan(const StringIndex& index, const RecordFile& rf, const std::string& lo, const std::string* hi, bool valueOnly);
+
+  RC open();
+  RC next(TupleBatch& batch);
+
+ private:
+  const StringIndex&       index;
+  const RecordFile&        rf;
+  StringScan               scan;
+  std::string              lo, hi;
+  bool                     hasHi;
+  bool                     valueOnly;
+  bool                     done;    // true once the index has been read
+  std::vector<int>         keys;    // the tuples of the entries read
+  std::vector<std::string> values;
+  unsigned                 pos;     // the first tuple not passed on yet
+};
+
+/**
+ * look a key up in the hash index and fetch its tuples from the table.
+ */
+class HashLookup : public Operator {
+ public:
+  /**
+   * @param index[IN] the hash index. it must stay open during the lookup
+   * @param rf[IN] the table. it must stay open during the lookup
+   * @param key[IN] the key to look up
+   * @param readValues[IN] true if the values are needed
+   */
+  HashLookup(const HashIndex& index, const RecordFile& rf, int key, bool readValues);
+
+  RC open();
+  RC next(TupleBatch& batch);
+
+ private:
+  const HashIndex&         index;
+  const RecordFile&        rf;
+  int                      key;
+  bool                     readValues;
+  std::vector<int>         keys;    // the tuples with the key
+  std::vector<std::string> values;
+  unsigned                 pos;     // the first tuple not passed on yet
+};
+
+/**
+ * count the entries of the B+tree index with a key in [lo, hi] that is
+ * not excluded, from the entry counts kept in the index. the count is
+ * passed on as the key of a single tuple.
+ */
+class IndexCount : public Operator {
+ public:
+  /**
+   * @param tree[IN] the index on key. it must stay open during the count
+   * @param lo[IN] the smallest key to count
+   * @param hi[IN] the largest key to count
+   * @param excluded[IN] the keys not to count
+   */
+  IndexCount(const BTreeIndex& tree, int lo, int hi, const std::vector<int>& excluded);
+
+  RC open();
+  RC next(TupleBatch& batch);
+
+ private:
+  const BTreeIndex& tree;
+  int               lo, hi;
+  std::vector<int>  excluded;
+  bool              done;     // true once the count has been passed on
+};
+
+/**
+ * deselect the tuples that do not meet the conditions.
+ */
+class Filter : public Operator {
+ public:
+  /**
+   * @param child[IN] the input of the filter
+   * @param pred[IN] the conditions. the values of the input must have
+   *                 been read if there is a condition on value
+   */
+  Filter(Operator* child, const Predicate& pred);
+  ~Filter();
+
+  RC open();
+  RC next(TupleBatch& batch);
+
+ private:
+  Operator* child;
+  Predicate pred;
+};
+
+/**
+ * count the tuples of the input. the count is passed on as the key of a
+ * single tuple once the input is exhausted.
+ */
+class Count : public Operator {
+ public:
+  /**
+   * @param child[IN] the input of the count
+   */
+  explicit Count(Operator* child);
+  ~Count();
+
+  RC open();
+  RC next(TupleBatch& batch);
+
+ private:
+  Operator* child;
+  bool      done;     // true once the count has been passed on
+};
+
+/**
+ * print the tuples of the input on screen and pass them on.
+ */
+class Project : public Operator {
+ public:
+  /**
+   * @param child[IN] the input of the projection
+   * @param attr[IN] the attribute printed (1: key, 2: value, 3: *, 4:
+   *                 count(*), which is the key of the single tuple of a
+   *                 Count)
+   */
+  Project(Operator* child, int attr);
+  ~Project();
+
+  RC open();
+  RC next(TupleBatch& batch);
+
+ private:
+  Operator* child;
+  int       attr;
+};
+
+#endif /* EXECUTOR_H */
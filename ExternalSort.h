@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#ifndef EXTERNALSORT_H
+#define EXTERNALSORT_H
+
+#include <cstdio>
+#include <algorithm>
+#include <queue>
+#include <vector>
+#include "Bruinbase.h"
+
+/**
+ * sorts fixed-size entries that may not fit in memory, by their
+ * operator<. entries are kept in memory until bufferEntries of them have
+ * been added; they are then sorted and spilled to a temporary run file.
+ * once all entries are added, they are read back in order by merging the
+ * runs. entries are written to the runs as raw bytes, so Entry must not
+ * hold pointers.
+ */
+template <class Entry>
+class ExternalSort {
+ public:
+  /**
+   * @param bufferEntries[IN] # entries sorted in memory before they are
+   *                          spilled to a run file
+   */
+  ExternalSort(int bufferEntries) : bufferEntries(bufferEntries), pos(0), reading(false) { }
+  ~ExternalSort() { clear(); }
+
+  /**
+   * add an entry. entries cannot be added once they are being read.
+   * @param entry[IN] the entry
+   * @return error code. 0 if no error
+   */
+  RC add(const Entry& entry)
+  {
+    if (reading)
+      return RC_INVALID_CURSOR;
+    buffer.push_back(entry);
+    if ((int) buffer.size() >= bufferEntries)
+      return spill();
+    return 0;
+  }
+
+  /**
+   * read the next entry in order. the first call ends adding.
+   * @param entry[OUT] the entry
+   * @return error code. 0 if no error. RC_END_OF_FILE if no entry is left
+   */
+  RC next(Entry& entry)
+  {
+    RC rc;
+
+    if (!reading) {
+      reading = true;
+      pos = 0;
+      if (runs.empty()) {
+        // everything fits in memory
+        std::sort(buffer.begin(), buffer.end());
+      }
+      else {
+        if (!buffer.empty() && (rc = spill()) < 0)
+          return rc;
+        for (unsigned i = 0; i < runs.size(); i++) {
+          if ((rc = readRun(i)) < 0)
+            return rc;
+        }
+      }
+    }
+
+    if (runs.empty()) {
+      if (pos >= buffer.size())
+        return RC_END_OF_FILE;
+      entry = buffer[pos++];
+      return 0;
+    }
+
+    // take the smallest head entry of the runs
+    if (heads.empty())
+      return RC_END_OF_FILE;
+    Head h = heads.top();
+    heads.pop();
+    entry = h.first;
+    return readRun(h.second);
+  }
+
+  /**
+   * discard all entries and start over.
+   */
+  void clear()
+  {
+    for (unsigned i = 0; i < runs.size(); i++)
+      fclose(runs[i]);
+    runs.clear();
+    std::vector<Entry>().swap(buffer);
+    heads = HeadQueue();
+    pos = 0;
+    reading = false;
+  }
+
+ private:
+  ExternalSort(const ExternalSort&);            // sorts are not copyable
+  ExternalSort& operator=(const ExternalSort&);
+
+  typedef std::pair<Entry, unsigned> Head;  // (entry, run number)
+
+  // order the heads so that the smallest entry is on top
+  struct HeadAfter {
+    bool operator() (const Head& h1, const Head& h2) const { return h2.first < h1.first; }
+  };
+  typedef std::priority_queue<Head, std::vector<Head>, HeadAfter> HeadQueue;
+
+  // sort the entries in memory and spill them to a new run file
+  RC spill()
+  {
+    FILE* run = tmpfile();
+    if (run == NULL)
+      return RC_FILE_OPEN_FAILED;
+    runs.push_back(run);
+
+    std::sort(buffer.begin(), buffer.end());
+    if (fwrite(&buffer[0], sizeof(Entry), buffer.size(), run) != buffer.size())
+      return RC_FILE_WRITE_FAILED;
+    rewind(run);
+
+    buffer.clear();
+    return 0;
+  }
+
+  // read the next entry of run i into the heads, if the run has one
+  RC readRun(unsigned i)
+  {
+    Entry entry;
+    if (fread(&entry, sizeof(Entry), 1, runs[i]) == 1)
+      heads.push(Head(entry, i));
+    else if (ferror(runs[i]))
+      return RC_FILE_READ_FAILED;
+    return 0;
+  }
+
+  int                 bufferEntries; // # entries kept in memory at most
+  std::vector<Entry>  buffer;        // the entries not spilled yet
+  std::vector<FILE*>  runs;          // the sorted runs spilled so far
+  HeadQueue           heads;         // the next entry of each run
+  unsigned            pos;           // the next entry of buffer to read
+  bool                reading;       // true once the entries are read
+};
+
+#endif /* EXTERNALSORT_H */
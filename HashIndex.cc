@@ -0,0 +1,468 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#include "HashIndex.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+const double HashIndex::MAX_LOAD_FACTOR = 0.75;
+
+// identifies page 0 of a hash index
+static const int HASH_INDEX_MAGIC = 0x58444848; // "HHDX"
+
+// # bytes of the header of a bucket page: [count][overflow pid]
+static const int BUCKET_HEADER_SIZE = sizeof(int) + sizeof(PageId);
+
+// mix the bits of the key, so that the low bits choosing the bucket
+// depend on all of them
+static unsigned hashKey(int key)
+{
+  unsigned h = (unsigned) key;
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+// the block holding the bucket
+static int blockOf(int bucket)
+{
+  int block = 0;
+  while (bucket > 0) {
+    bucket >>= 1;
+    block++;
+  }
+  return block;
+}
+
+// the first bucket of the block
+static int firstBucketOf(int block)
+{
+  return (block == 0) ? 0 : 1 << (block - 1);
+}
+
+// a bucket page with the entries [from, to), linked to the page next
+static void makeBucketPage(char* page, const vector<HashEntry>& entries, unsigned from, unsigned to, PageId next)
+{
+  int count = to - from;
+
+  memset(page, 0, PageFile::PAGE_SIZE);
+  memcpy(page, &count, sizeof(int));
+  memcpy(page + sizeof(int), &next, sizeof(PageId));
+  if (count > 0)
+    memcpy(page + BUCKET_HEADER_SIZE, &entries[from], count * sizeof(HashEntry));
+}
+
+/*
+ * orders entries by the bucket they belong to, for the given # buckets
+ * (a power of 2).
+ */
+struct BucketOrder {
+  unsigned mask;
+  BucketOrder(unsigned buckets) : mask(buckets - 1) { }
+  bool operator() (const HashEntry& e1, const HashEntry& e2) const {
+    return (hashKey(e1.key) & mask) < (hashKey(e2.key) & mask);
+  }
+};
+
+HashIndex::HashIndex()
+: fileMode('r'), level(0), nextSplit(0), entryCount(0), freeList(0), bulkLoading(false)
+{
+  memset(blockStart, 0, sizeof(blockStart));
+}
+
+RC HashIndex::open(const string& indexname, char mode)
+{
+  RC rc;
+  if ((rc = pf.open(indexname, mode)) < 0)
+    return rc;
+  fileMode = mode;
+
+  if (pf.endPid() == 0) {
+    if (mode == 'r' || mode == 'R') { // nothing to read from an empty index
+      pf.close();
+      return RC_INVALID_FILE_FORMAT;
+    }
+    level = nextSplit = entryCount = 0;
+    freeList = 0;
+    memset(blockStart, 0, sizeof(blockStart));
+    return writeMetadata();
+  }
+
+  char buffer[PageFile::PAGE_SIZE];
+  int  magic;
+
+  if ((rc = pf.read(0, buffer)) < 0)
+    return rc;
+  memcpy(&magic, buffer, sizeof(int));
+  memcpy(&level, buffer + sizeof(int), sizeof(int));
+  memcpy(&nextSplit, buffer + sizeof(int)*2, sizeof(int));
+  memcpy(&entryCount, buffer + sizeof(int)*3, sizeof(int));
+  memcpy(blockStart, buffer + sizeof(int)*4, sizeof(blockStart));
+  memcpy(&freeList, buffer + sizeof(int)*4 + sizeof(blockStart), sizeof(PageId));
+  if (magic != HASH_INDEX_MAGIC || level < 0 || level >= MAX_BLOCKS - 1) {
+    pf.close();
+    return RC_INVALID_FILE_FORMAT;
+  }
+
+  // lookups jump around the index file
+  pf.advise(PageFile::ACCESS_RANDOM);
+
+  return 0;
+}
+
+RC HashIndex::close()
+{
+  bulkLoading = false;
+  bulkEntries.clear();
+
+  // the metadata can only have changed under 'w' mode
+  if (fileMode == 'r' || fileMode == 'R')
+    return pf.close();
+
+  RC rc;
+  if ((rc = writeMetadata()) < 0)
+    return rc;
+  return pf.close();
+}
+
+RC HashIndex::writeMetadata()
+{
+  char buffer[PageFile::PAGE_SIZE];
+  int  magic = HASH_INDEX_MAGIC;
+
+  memset(buffer, 0, PageFile::PAGE_SIZE);
+  memcpy(buffer, &magic, sizeof(int));
+  memcpy(buffer + sizeof(int), &level, sizeof(int));
+  memcpy(buffer + sizeof(int)*2, &nextSplit, sizeof(int));
+  memcpy(buffer + sizeof(int)*3, &entryCount, sizeof(int));
+  memcpy(buffer + sizeof(int)*4, blockStart, sizeof(blockStart));
+  memcpy(buffer + sizeof(int)*4 + sizeof(blockStart), &freeList, sizeof(PageId));
+
+  return pf.write(0, buffer);
+}
+
+int HashIndex::bucketOf(int key) const
+{
+  unsigned h = hashKey(key);
+  int      bucket = h & ((1u << level) - 1);
+
+  // the buckets before nextSplit have been split in this round
+  if (bucket < nextSplit)
+    bucket = h & ((2u << level) - 1);
+  return bucket;
+}
+
+PageId HashIndex::bucketPid(int bucket) const
+{
+  int block = blockOf(bucket);
+  return blockStart[block] + (bucket - firstBucketOf(block));
+}
+
+RC HashIndex::lookup(int key, vector<RecordId>& rids) const
+{
+  RC        rc;
+  char      page[PageFile::PAGE_SIZE];
+  int       count;
+  HashEntry entry;
+
+  rids.clear();
+  if (blockStart[0] == 0)
+    return 0;
+
+  // follow the overflow chain of the bucket
+  for (PageId pid = bucketPid(bucketOf(key)); pid > 0; ) {
+    if ((rc = pf.read(pid, page)) < 0)
+      return rc;
+    memcpy(&count, page, sizeof(int));
+    memcpy(&pid, page + sizeof(int), sizeof(PageId));
+    if (count < 0 || count > ENTRIES_PER_PAGE)
+      return RC_INVALID_FILE_FORMAT;
+    for (int i = 0; i < count; i++) {
+      memcpy(&entry, page + BUCKET_HEADER_SIZE + i * sizeof(HashEntry), sizeof(HashEntry));
+      if (entry.key == key)
+        rids.push_back(entry.rid);
+    }
+  }
+  return 0;
+}
+
+RC HashIndex::insert(int key, const RecordId& rid)
+{
+  RC        rc;
+  char      page[PageFile::PAGE_SIZE];
+  int       count;
+  PageId    pid, next;
+  HashEntry entry;
+
+  // the first entry creates bucket 0
+  if (blockStart[0] == 0) {
+    vector<HashEntry> none;
+    blockStart[0] = max(pf.endPid(), 1);
+    makeBucketPage(page, none, 0, 0, -1);
+    if ((rc = pf.write(blockStart[0], page)) < 0)
+      return rc;
+  }
+
+  entry.key = key;
+  entry.rid = rid;
+
+  // the entry goes to the last page of the chain, or to a new page
+  // after it if the last page is full
+  for (pid = bucketPid(bucketOf(key)); ; pid = next) {
+    if ((rc = pf.read(pid, page)) < 0)
+      return rc;
+    memcpy(&count, page, sizeof(int));
+    memcpy(&next, page + sizeof(int), sizeof(PageId));
+    if (next <= 0) break;
+  }
+
+  if (count < ENTRIES_PER_PAGE) {
+    memcpy(page + BUCKET_HEADER_SIZE + count * sizeof(HashEntry), &entry, sizeof(HashEntry));
+    count++;
+    memcpy(page, &count, sizeof(int));
+    if ((rc = pf.write(pid, page)) < 0)
+      return rc;
+  }
+  else {
+    char overflow[PageFile::PAGE_SIZE];
+    vector<HashEntry> entries(1, entry);
+    PageId end = pf.endPid();
+    if ((rc = takePage(next, end)) < 0)
+      return rc;
+    makeBucketPage(overflow, entries, 0, 1, -1);
+    if ((rc = pf.write(next, overflow)) < 0)
+      return rc;
+    memcpy(page + sizeof(int), &next, sizeof(PageId));
+    if ((rc = pf.write(pid, page)) < 0)
+      return rc;
+  }
+  entryCount++;
+
+  // a bucket splits once the entries fill too much of the buckets
+  int buckets = (1 << level) + nextSplit;
+  if (entryCount > MAX_LOAD_FACTOR * ENTRIES_PER_PAGE * buckets)
+    return split();
+  return 0;
+}
+
+RC HashIndex::split()
+{
+  RC                rc;
+  char              page[PageFile::PAGE_SIZE];
+  int               count;
+  int               bucket = nextSplit;
+  int               sibling, block;
+  vector<HashEntry> stay, move;
+  vector<PageId>    spare;
+  HashEntry         entry;
+
+  // the new bucket belongs to block level + 1
+  if (level + 1 >= MAX_BLOCKS)
+    return RC_NODE_FULL;
+  sibling = nextSplit + (1 << level);
+  block = blockOf(sibling);
+
+  // the first split into a block allocates all the buckets of the block.
+  // block k > 0 has as many buckets as the ones before it
+  if (blockStart[block] == 0) {
+    vector<HashEntry> none;
+    PageId first = pf.endPid();
+    makeBucketPage(page, none, 0, 0, -1);
+    for (int i = 0; i < firstBucketOf(block); i++) {
+      if ((rc = pf.write(first + i, page)) < 0)
+        return rc;
+    }
+    blockStart[block] = first;
+  }
+
+  // read the entries of the bucket and divide them by the next hash bit.
+  // its overflow pages are used again by the two buckets
+  for (PageId pid = bucketPid(bucket); pid > 0; ) {
+    if (pid != bucketPid(bucket))
+      spare.push_back(pid);
+    if ((rc = pf.read(pid, page)) < 0)
+      return rc;
+    memcpy(&count, page, sizeof(int));
+    memcpy(&pid, page + sizeof(int), sizeof(PageId));
+    for (int i = 0; i < count; i++) {
+      memcpy(&entry, page + BUCKET_HEADER_SIZE + i * sizeof(HashEntry), sizeof(HashEntry));
+      if ((hashKey(entry.key) & ((2u << level) - 1)) == (unsigned) bucket)
+        stay.push_back(entry);
+      else
+        move.push_back(entry);
+    }
+  }
+
+  // the overflow pages neither bucket needs any more are freed
+  PageId end = pf.endPid();
+  if ((rc = writeChain(bucketPid(bucket), stay, spare, end)) < 0 ||
+      (rc = writeChain(bucketPid(sibling), move, spare, end)) < 0 ||
+      (rc = freePages(spare)) < 0)
+    return rc;
+
+  // the round ends once every bucket at its start has been split
+  if (++nextSplit == (1 << level)) {
+    level++;
+    nextSplit = 0;
+  }
+  return 0;
+}
+
+RC HashIndex::writeChain(PageId first, const vector<HashEntry>& entries, vector<PageId>& spare, PageId& end)
+{
+  RC             rc;
+  char           page[PageFile::PAGE_SIZE];
+  vector<PageId> pids(1, first);
+  PageId         pid;
+
+  // the pages of the chain
+  for (unsigned n = ENTRIES_PER_PAGE; n < entries.size(); n += ENTRIES_PER_PAGE) {
+    if (!spare.empty()) {
+      pids.push_back(spare.back());
+      spare.pop_back();
+    }
+    else {
+      if ((rc = takePage(pid, end)) < 0)
+        return rc;
+      pids.push_back(pid);
+    }
+  }
+
+  for (unsigned i = 0; i < pids.size(); i++) {
+    unsigned from = i * ENTRIES_PER_PAGE;
+    unsigned to = min<unsigned>(from + ENTRIES_PER_PAGE, entries.size());
+    makeBucketPage(page, entries, from, to, (i + 1 < pids.size()) ? pids[i + 1] : -1);
+    if ((rc = pf.write(pids[i], page)) < 0)
+      return rc;
+  }
+  return 0;
+}
+
+RC HashIndex::takePage(PageId& pid, PageId& end)
+{
+  RC   rc;
+  char page[PageFile::PAGE_SIZE];
+
+  if (freeList <= 0) {
+    pid = end++;
+    return 0;
+  }
+
+  // a free page is linked to the next one like an overflow page
+  if ((rc = pf.read(freeList, page)) < 0)
+    return rc;
+  pid = freeList;
+  memcpy(&freeList, page + sizeof(int), sizeof(PageId));
+  return 0;
+}
+
+RC HashIndex::freePages(const vector<PageId>& pids)
+{
+  RC                rc;
+  char              page[PageFile::PAGE_SIZE];
+  vector<HashEntry> none;
+
+  for (unsigned i = 0; i < pids.size(); i++) {
+    makeBucketPage(page, none, 0, 0, freeList);
+    if ((rc = pf.write(pids[i], page)) < 0)
+      return rc;
+    freeList = pids[i];
+  }
+  return 0;
+}
+
+RC HashIndex::beginBulkLoad()
+{
+  if (blockStart[0] != 0)
+    return RC_INVALID_FILE_FORMAT;
+  bulkEntries.clear();
+  bulkLoading = true;
+  return 0;
+}
+
+RC HashIndex::bulkInsert(int key, const RecordId& rid)
+{
+  if (!bulkLoading)
+    return insert(key, rid);
+
+  HashEntry entry;
+  entry.key = key;
+  entry.rid = rid;
+  bulkEntries.push_back(entry);
+  return 0;
+}
+
+RC HashIndex::endBulkLoad()
+{
+  RC       rc = 0;
+  char     page[PageFile::PAGE_SIZE];
+  unsigned buckets = 1;
+  unsigned n = bulkEntries.size();
+
+  if (!bulkLoading)
+    return 0;
+  bulkLoading = false;
+  if (n == 0)
+    return 0;
+
+  // start with as many buckets as keep the load under MAX_LOAD_FACTOR.
+  // a whole round has been split, so all blocks up to level are full
+  for (level = 0; n > MAX_LOAD_FACTOR * ENTRIES_PER_PAGE * buckets; level++)
+    buckets <<= 1;
+  nextSplit = 0;
+  entryCount = n;
+  if (level >= MAX_BLOCKS - 1)
+    return RC_INVALID_FILE_FORMAT;
+
+  // the buckets take the pages right after page 0, in bucket order
+  PageId first = max(pf.endPid(), 1);
+  for (int block = 0; block <= level; block++)
+    blockStart[block] = first + firstBucketOf(block);
+  stable_sort(bulkEntries.begin(), bulkEntries.end(), BucketOrder(buckets));
+
+  // write the bucket pages in order, followed by the overflow pages
+  vector<unsigned> from(buckets + 1, n);
+  for (unsigned i = n; i-- > 0; )
+    from[hashKey(bulkEntries[i].key) & (buckets - 1)] = i;
+  for (unsigned b = buckets; b-- > 0; )
+    from[b] = min(from[b], from[b + 1]);
+
+  PageId overflow = first + buckets;
+  for (unsigned b = 0; b < buckets; b++) {
+    unsigned to = min<unsigned>(from[b] + ENTRIES_PER_PAGE, from[b + 1]);
+    makeBucketPage(page, bulkEntries, from[b], to, (to < from[b + 1]) ? overflow : -1);
+    if ((rc = pf.write(first + b, page)) < 0)
+      goto exit_bulk;
+    while (to < from[b + 1]) {
+      overflow++;
+      to += ENTRIES_PER_PAGE;
+    }
+  }
+
+  overflow = first + buckets;
+  for (unsigned b = 0; b < buckets; b++) {
+    for (unsigned i = from[b] + ENTRIES_PER_PAGE; i < from[b + 1]; i += ENTRIES_PER_PAGE) {
+      unsigned to = min<unsigned>(i + ENTRIES_PER_PAGE, from[b + 1]);
+      makeBucketPage(page, bulkEntries, i, to, (to < from[b + 1]) ? overflow + 1 : -1);
+      if ((rc = pf.write(overflow++, page)) < 0)
+        goto exit_bulk;
+    }
+  }
+
+  rc = writeMetadata();
+
+  exit_bulk:
+  bulkEntries.clear();
+  return rc;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#ifndef HASHINDEX_H
+#define HASHINDEX_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "RecordFile.h"
+
+/**
+ * a (key, RecordId) pair stored in a HashIndex bucket.
+ */
+typedef struct {
+  int      key;
+  RecordId rid;
+} HashEntry;
+
+/**
+ * a linear hash index on the key column, for point queries.
+ *
+ * every bucket is a page of [count][overflow pid][(key, rid) ...], with a
+ * chain of overflow pages once it is full. buckets split one at a time,
+ * in order, whenever the entries fill more than MAX_LOAD_FACTOR of the
+ * buckets, so a lookup normally reads the bucket page alone.
+ *
+ * the buckets are allocated in blocks that double in size: block 0 holds
+ * bucket 0 and block k holds buckets 2^(k-1) to 2^k - 1. the first page
+ * of every block is kept in page 0, so the page of a bucket is computed
+ * rather than looked up in a directory. overflow pages left over by a
+ * split are linked into a free list, which page 0 also keeps, and are
+ * used again before the file grows.
+ *
+ * the index is not safe to use from several threads at a time.
+ */
+class HashIndex {
+ public:
+  // # entries in a bucket page
+  static const int ENTRIES_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int) - sizeof(PageId)) / sizeof(HashEntry);
+
+  // the largest # entries per bucket slot before the next bucket splits
+  static const double MAX_LOAD_FACTOR;
+
+  // # blocks of buckets at most
+  static const int MAX_BLOCKS = 32;
+
+  HashIndex();
+
+  /**
+   * open the index file in read or write mode.
+   * under 'w' mode, the index file is created if it does not exist.
+   * @param indexname[IN] the name of the index file
+   * @param mode[IN] 'r' for read, 'w' for write
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& indexname, char mode);
+
+  /**
+   * close the index file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * insert (key, RecordId) pair to the index.
+   * @param key[IN] the key of the record
+   * @param rid[IN] the RecordId of the record
+   * @return error code. 0 if no error. RC_NODE_FULL if the entry was
+   *         inserted but the buckets cannot grow past MAX_BLOCKS blocks
+   */
+  RC insert(int key, const RecordId& rid);
+
+  /**
+   * find the records with the key.
+   * @param key[IN] the key to look up
+   * @param rids[OUT] the RecordIds of the records with the key
+   * @return error code. 0 if no error
+   */
+  RC lookup(int key, std::vector<RecordId>& rids) const;
+
+  /**
+   * start building an empty index at once. the entries passed to
+   * bulkInsert() are kept in memory and written by endBulkLoad() into as
+   * many buckets as they need, each bucket written once.
+   * @return error code. 0 if no error. RC_INVALID_FILE_FORMAT if
+   *         the index is not empty.
+   */
+  RC beginBulkLoad();
+
+  /**
+   * add a (key, RecordId) pair to an index being bulk loaded.
+   * @param key[IN] the key of the record
+   * @param rid[IN] the RecordId of the record
+   * @return error code. 0 if no error
+   */
+  RC bulkInsert(int key, const RecordId& rid);
+
+  /**
+   * build the index from the entries passed to bulkInsert().
+   * @return error code. 0 if no error
+   */
+  RC endBulkLoad();
+
+ private:
+  // the bucket the key belongs to
+  int bucketOf(int key) const;
+
+  // the first page of the bucket
+  PageId bucketPid(int bucket) const;
+
+  // split the next bucket in line into itself and a new bucket.
+  // RC_NODE_FULL if the new bucket would be past the last block
+  RC split();
+
+  // write the entries to a chain of pages starting at first. the other
+  // pages are taken from spare first, then from the free list and then
+  // from the end of the file, which is advanced
+  RC writeChain(PageId first, const std::vector<HashEntry>& entries, std::vector<PageId>& spare, PageId& end);
+
+  // take a page for an overflow page off the free list, or from the end
+  // of the file if the list is empty, advancing end
+  RC takePage(PageId& pid, PageId& end);
+
+  // add the pages to the free list
+  RC freePages(const std::vector<PageId>& pids);
+
+  // write level, nextSplit, entryCount, the blocks and the free list
+  // to page 0
+  RC writeMetadata();
+
+  PageFile pf;         // the PageFile used to store the index in disk
+  char     fileMode;   // the mode the index file was opened in
+  int      level;      // 2^level buckets at the start of the current round
+  int      nextSplit;  // the next bucket to split in this round
+  int      entryCount; // # entries in the index
+  PageId   blockStart[MAX_BLOCKS]; // the first page of each block (0 if none)
+  PageId   freeList;   // the first free overflow page (0 if none)
+
+  bool     bulkLoading; // true between begin/endBulkLoad()
+  std::vector<HashEntry> bulkEntries; // the entries to load
+};
+
+#endif /* HASHINDEX_H */
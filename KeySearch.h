@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#ifndef KEYSEARCH_H
+#define KEYSEARCH_H
+
+#include <cstring>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KEY_SEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+//
+// in-node key search.
+// keys are found with a branchless binary search that narrows the range
+// down to SEARCH_WINDOW keys, which are then compared all at once by a
+// counting kernel. the kernel is picked at startup by the CPU features.
+// the kernels are kept here so that they can be measured one by one.
+//
+
+// # keys compared by the counting kernel at the end of the binary search
+static const int SEARCH_WINDOW = 16;
+
+// read the n'th key of a key array
+static inline int keyAt(const char* keys, int n)
+{
+  int key;
+  memcpy(&key, keys + n * sizeof(int), sizeof(int));
+  return key;
+}
+
+// count the keys smaller than searchKey one by one, without branches
+static inline int countLessScalar(const char* keys, int count, int searchKey)
+{
+  int n = 0;
+  for (int i = 0; i < count; i++)
+    n += (keyAt(keys, i) < searchKey);
+  return n;
+}
+
+#ifdef __SSE2__
+// count the keys smaller than searchKey, four keys at a time
+static inline int countLessSse2(const char* keys, int count, int searchKey)
+{
+  const __m128i search = _mm_set1_epi32(searchKey);
+  int n = 0, i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    __m128i k = _mm_loadu_si128((const __m128i*) (keys + i * sizeof(int)));
+    __m128i lt = _mm_cmplt_epi32(k, search);
+    n += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(lt)));
+  }
+  return n + countLessScalar(keys + i * sizeof(int), count - i, searchKey);
+}
+#endif
+
+#ifdef KEY_SEARCH_X86
+// count the keys smaller than searchKey, eight keys at a time
+__attribute__((target("avx2")))
+static inline int countLessAvx2(const char* keys, int count, int searchKey)
+{
+  const __m256i search = _mm256_set1_epi32(searchKey);
+  int n = 0, i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m256i k = _mm256_loadu_si256((const __m256i*) (keys + i * sizeof(int)));
+    __m256i lt = _mm256_cmpgt_epi32(search, k);
+    n += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(lt)));
+  }
+  return n + countLessScalar(keys + i * sizeof(int), count - i, searchKey);
+}
+#endif
+
+typedef int (*CountLessKernel)(const char* keys, int count, int searchKey);
+
+// pick the fastest counting kernel the CPU supports
+static inline CountLessKernel selectCountLessKernel()
+{
+#ifdef KEY_SEARCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return countLessAvx2;
+#endif
+#ifdef __SSE2__
+  return countLessSse2;
+#else
+  return countLessScalar;
+#endif
+}
+
+// return the # keys smaller than searchKey in a sorted key array, using
+// the given counting kernel
+static inline int lowerBoundWith(CountLessKernel countLess, const char* keys, int count, int searchKey)
+{
+  int base = 0, len = count;
+
+  // every key before base is smaller than searchKey and the answer lies
+  // within [base, base + len]
+  while (len > SEARCH_WINDOW) {
+    int half = len / 2;
+    base = (keyAt(keys, base + half - 1) < searchKey) ? base + half : base;
+    len -= half;
+  }
+  return base + countLess(keys + base * sizeof(int), len, searchKey);
+}
+
+#endif /* KEYSEARCH_H */
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+/*
+ * A microbenchmark of the in-node key search. Full and half-full nodes
+ * of random sorted keys are searched for random keys with the binary
+ * search over each counting kernel of KeySearch.h, and with the linear
+ * scan over interleaved (RecordId, key) entries that nodes used before
+ * their keys were stored contiguously. Every search must find the same
+ * position. The time of a search is printed for each.
+ *
+ * build with "make keysearchbench".
+ * usage: keysearchbench [searches]
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <sys/time.h>
+#include "BTreeNode.h"
+#include "KeySearch.h"
+
+using namespace std;
+
+// # nodes searched, so that they do not all stay in the L1 cache
+static const int NODES = 1024;
+
+// the size of an entry of the old leaf layout: a RecordId and a key
+static const int OLD_ENTRY_SIZE = sizeof(RecordId) + sizeof(int);
+
+typedef struct {
+  const char*     name;
+  CountLessKernel kernel;  // NULL for the old linear scan
+} Search;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// the old leaf search: scan the entries until a key that is not smaller
+// than searchKey
+static int linearScan(const char* entries, int count, int searchKey)
+{
+  int key, i;
+  const char* ptr = entries + sizeof(RecordId);
+  for (i = 0; i < count; i++, ptr += OLD_ENTRY_SIZE) {
+    memcpy(&key, ptr, sizeof(int));
+    if (key >= searchKey) break;
+  }
+  return i;
+}
+
+// search the nodes of count keys for the search keys and return the sum
+// of the positions found, with the time taken per search
+static long runSearch(const Search& s, const vector<char>& keys, const vector<char>& entries,
+                      int count, const vector<int>& searchKeys, double& ns)
+{
+  long   sum = 0;
+  double start = now();
+
+  for (unsigned i = 0; i < searchKeys.size(); i++) {
+    int node = i % NODES;
+    if (s.kernel == NULL)
+      sum += linearScan(&entries[(size_t) node * count * OLD_ENTRY_SIZE], count, searchKeys[i]);
+    else
+      sum += lowerBoundWith(s.kernel, &keys[(size_t) node * count * sizeof(int)], count, searchKeys[i]);
+  }
+  ns = (now() - start) * 1e9 / searchKeys.size();
+  return sum;
+}
+
+// fill the nodes with count random sorted keys each, in both layouts
+static void makeNodes(int count, unsigned& seed, vector<char>& keys, vector<char>& entries)
+{
+  vector<int> node(count);
+  RecordId    rid = { 0, 0 };
+
+  keys.assign((size_t) NODES * count * sizeof(int), 0);
+  entries.assign((size_t) NODES * count * OLD_ENTRY_SIZE, 0);
+  for (int n = 0; n < NODES; n++) {
+    for (int i = 0; i < count; i++) node[i] = rand_r(&seed);
+    sort(node.begin(), node.end());
+    for (int i = 0; i < count; i++) {
+      char* entry = &entries[((size_t) n * count + i) * OLD_ENTRY_SIZE];
+      memcpy(&keys[((size_t) n * count + i) * sizeof(int)], &node[i], sizeof(int));
+      memcpy(entry, &rid, sizeof(RecordId));
+      memcpy(entry + sizeof(RecordId), &node[i], sizeof(int));
+    }
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  int searches = (argc > 1) ? atoi(argv[1]) : 10000000;
+
+  if (searches <= 0) {
+    fprintf(stderr, "usage: %s [searches]\n", argv[0]);
+    return 1;
+  }
+
+  vector<Search> kinds;
+  Search linear = { "linear scan (old)", NULL };
+  Search scalar = { "binary + scalar", countLessScalar };
+  kinds.push_back(linear);
+  kinds.push_back(scalar);
+#ifdef __SSE2__
+  Search sse2 = { "binary + SSE2", countLessSse2 };
+  kinds.push_back(sse2);
+#endif
+#ifdef KEY_SEARCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    Search avx2 = { "binary + AVX2", countLessAvx2 };
+    kinds.push_back(avx2);
+  }
+#endif
+
+  unsigned    seed = 1;
+  vector<int> searchKeys(searches);
+  for (int i = 0; i < searches; i++) searchKeys[i] = rand_r(&seed);
+
+  // full leaf and nonleaf nodes, and nodes just split
+  int counts[] = { BTLeafNode::ENTRIES_PER_PAGE, BTLeafNode::ENTRIES_PER_PAGE / 2, 16 };
+  for (unsigned c = 0; c < sizeof(counts) / sizeof(int); c++) {
+    vector<char> keys, entries;
+    makeNodes(counts[c], seed, keys, entries);
+
+    fprintf(stdout, "%d keys per node:\n", counts[c]);
+    long expected = 0;
+    for (unsigned k = 0; k < kinds.size(); k++) {
+      double ns;
+      long   sum = runSearch(kinds[k], keys, entries, counts[c], searchKeys, ns);
+      if (k == 0)
+        expected = sum;
+      else if (sum != expected) {
+        fprintf(stderr, "Error: %s finds other positions than the linear scan\n", kinds[k].name);
+        return 1;
+      }
+      fprintf(stdout, "  %-18s %6.1f ns/search\n", kinds[k].name, ns);
+    }
+  }
+
+  fprintf(stdout, "OK\n");
+  return 0;
+}
@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# Copyright (C) 2008 by The Regents of the University of California
+# Redistribution of this file is permitted under the terms of the GNU
+# Public License (GPL).
+#
+# Load values longer than the longest key of the value index (255
+# characters) WITH INDEX ON value, and check that the conditions on value
+# find exactly the tuples holding them.
+#
+# run with "make test".
+# usage: LongValueTest.sh [bruinbase]
+
+BRUINBASE=`cd \`dirname "${1:-./bruinbase}"\` && pwd`/`basename "${1:-./bruinbase}"`
+DIR=`mktemp -d` || exit 1
+trap 'rm -rf "$DIR"' 0
+
+# V1 and V2 differ only after their first 255 characters, which are V3
+V1=`printf '%0300d' 1`
+V2=`printf '%0300d' 2`
+V3=`printf '%0255d' 0`
+V5=`printf '%0400d' 0 | tr 0 z`
+
+cat > "$DIR/long.del" <<EOF
+1,'$V1'
+2,'$V2'
+3,'$V3'
+4,'short'
+5,'$V5'
+EOF
+
+cat > "$DIR/expected" <<EOF
+1
+2
+3
+4
+2
+$V5
+EOF
+
+(cd "$DIR" && "$BRUINBASE" > actual 2> errors) <<EOF
+LOAD long FROM 'long.del' WITH INDEX ON value
+SELECT key FROM long WHERE value = '$V1'
+SELECT key FROM long WHERE value = '$V2'
+SELECT key FROM long WHERE value = '$V3'
+SELECT COUNT(*) FROM long WHERE value > '$V3'
+SELECT COUNT(*) FROM long WHERE value >= '$V1' AND value <= '$V2'
+SELECT value FROM long WHERE value > 'short'
+EOF
+
+sed 's/Bruinbase> //g; /^$/d' "$DIR/actual" > "$DIR/result"
+if grep Error "$DIR/errors" || ! cmp -s "$DIR/expected" "$DIR/result"; then
+  echo "FAILED: long values"
+  diff "$DIR/expected" "$DIR/result" | cut -c 1-80
+  exit 1
+fi
+echo "OK"
@@ -11,6 +11,7 @@
 #include "PageFile.h"
 #include <cstring>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -18,19 +19,145 @@ using std::string;
 
 int PageFile::readCount = 0;
 int PageFile::writeCount = 0;
-int PageFile::cacheClock = 1;
-struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_COUNT];
+int PageFile::hitCount = 0;
+int PageFile::missCount = 0;
+
+struct PageFile::cacheStruct* PageFile::cacheFrames = NULL;
+struct PageFile::cacheShard*  PageFile::cacheShards = NULL;
+char* PageFile::cacheData = NULL;
+int*  PageFile::cacheBuckets = NULL;
+int   PageFile::cacheCount = 0;
+int   PageFile::bucketMask = 0;
+int   PageFile::shardCount = 0;
+int   PageFile::shardMask = 0;
+pthread_once_t PageFile::cacheOnce = PTHREAD_ONCE_INIT;
+
+RC PageFile::setCacheSize(int frames)
+{
+  int buckets, shards;
+
+  if (frames <= 0) return RC_INVALID_CACHE_SIZE;
+
+  // use at least twice as many hash buckets as frames
+  for (buckets = 1; buckets < 2 * frames; buckets <<= 1);
+
+  // a small pool is not split, so that a shard always has room for the
+  // pages a thread keeps pinned
+  for (shards = 1; shards < MAX_CACHE_SHARDS && 2 * shards * MIN_SHARD_FRAMES <= frames; shards <<= 1);
+
+  for (int i = 0; i < shardCount; i++) pthread_mutex_destroy(&cacheShards[i].latch);
+  delete [] cacheFrames;
+  delete [] cacheShards;
+  delete [] cacheData;
+  delete [] cacheBuckets;
+
+  cacheFrames = new cacheStruct[frames];
+  cacheShards = new cacheShard[shards];
+  cacheData = new char[(size_t) frames * PAGE_SIZE];
+  cacheBuckets = new int[buckets];
+
+  for (int i = 0; i < frames; i++) {
+    cacheFrames[i].fd = -1;
+    cacheFrames[i].pid = 0;
+    cacheFrames[i].next = -1;
+    cacheFrames[i].referenced = 0;
+    cacheFrames[i].pinCount = 0;
+  }
+  for (int i = 0; i < buckets; i++) cacheBuckets[i] = -1;
+
+  // divide the frames evenly among the shards
+  for (int i = 0; i < shards; i++) {
+    pthread_mutex_init(&cacheShards[i].latch, NULL);
+    cacheShards[i].firstFrame = (int) ((long) frames * i / shards);
+    cacheShards[i].endFrame = (int) ((long) frames * (i + 1) / shards);
+    cacheShards[i].clockHand = cacheShards[i].firstFrame;
+  }
+
+  cacheCount = frames;
+  bucketMask = buckets - 1;
+  shardCount = shards;
+  shardMask = shards - 1;
+  return 0;
+}
+
+void PageFile::initCache()
+{
+  if (cacheCount == 0) setCacheSize(DEFAULT_CACHE_COUNT);
+}
+
+int PageFile::hashBucket(int fd, PageId pid)
+{
+  unsigned h = (unsigned) pid * 2654435761u ^ (unsigned) fd * 40503u;
+  return (int) ((h ^ (h >> 16)) & bucketMask);
+}
+
+int PageFile::lookupFrame(int fd, PageId pid)
+{
+  for (int i = cacheBuckets[hashBucket(fd, pid)]; i >= 0; i = cacheFrames[i].next) {
+    if (cacheFrames[i].fd == fd && cacheFrames[i].pid == pid) return i;
+  }
+  return -1;
+}
+
+void PageFile::insertFrame(int frame, int fd, PageId pid)
+{
+  int b = hashBucket(fd, pid);
+
+  cacheFrames[frame].fd = fd;
+  cacheFrames[frame].pid = pid;
+  cacheFrames[frame].next = cacheBuckets[b];
+  cacheBuckets[b] = frame;
+}
+
+void PageFile::removeFrame(int frame)
+{
+  int* link = &cacheBuckets[hashBucket(cacheFrames[frame].fd, cacheFrames[frame].pid)];
+
+  // find the link pointing to the frame and bypass it
+  while (*link != frame) link = &cacheFrames[*link].next;
+  *link = cacheFrames[frame].next;
+
+  cacheFrames[frame].fd = -1;
+  cacheFrames[frame].pid = 0;
+  cacheFrames[frame].next = -1;
+  cacheFrames[frame].referenced = 0;
+  cacheFrames[frame].pinCount = 0;
+}
+
+int PageFile::evictFrame(int shard)
+{
+  cacheShard& s = cacheShards[shard];
+
+  // sweep the clock hand, giving a second chance to referenced frames.
+  // two full rounds without a victim mean that every frame is pinned.
+  for (int n = 0; n < 2 * (s.endFrame - s.firstFrame); n++) {
+    int i = s.clockHand;
+    if (++s.clockHand >= s.endFrame) s.clockHand = s.firstFrame;
+
+    if (cacheFrames[i].fd < 0) return i;
+    if (cacheFrames[i].pinCount > 0) continue;
+    if (cacheFrames[i].referenced) {
+      cacheFrames[i].referenced = 0;
+      continue;
+    }
+    removeFrame(i);
+    return i;
+  }
+  return -1;
+}
 
 PageFile::PageFile() 
 { 
   fd = -1; 
   epid = 0; 
+  map = NULL;
 }
 
 PageFile::PageFile(const string& filename, char mode)
 {
   fd = -1;
   epid = 0;
+  map = NULL;
   open(filename.c_str(), mode);
 }
 
@@ -38,12 +165,17 @@ RC PageFile::open(const string& filename, char mode)
 {
   RC   rc;
   int  oflag;
+  bool mapped = false;
   struct stat statbuf;
 
   if (fd > 0) return RC_FILE_OPEN_FAILED;
 
   // set the unix file flag depending on the file mode
   switch (mode) {
+  case 'm':
+  case 'M':
+    mapped = true;
+    // fall through
   case 'r':
   case 'R':
     oflag = O_RDONLY;
@@ -65,6 +197,14 @@ RC PageFile::open(const string& filename, char mode)
   if (rc < 0) { ::close(fd); fd = -1; return RC_FILE_OPEN_FAILED; }
   epid = statbuf.st_size / PAGE_SIZE;
 
+  // a file opened in 'm' mode is mapped into memory so that page reads
+  // need neither a system call nor the buffer pool. if the mapping fails,
+  // we silently fall back to regular reads.
+  if (mapped && epid > 0) {
+    void* addr = ::mmap(NULL, (size_t) epid * PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr != MAP_FAILED) map = (char*) addr;
+  }
+
   return 0;
 }
 
@@ -72,16 +212,22 @@ RC PageFile::close()
 {
   if (fd <= 0) return RC_FILE_CLOSE_FAILED;
 
+  // unmap the file if it was mapped
+  if (map != NULL) {
+    ::munmap(map, (size_t) epid * PAGE_SIZE);
+    map = NULL;
+  }
+
   // close the file
   if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
 
   // evict all cached pages for this file
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
+  for (int s = 0; s < shardCount; s++) {
+    pthread_mutex_lock(&cacheShards[s].latch);
+    for (int i = cacheShards[s].firstFrame; i < cacheShards[s].endFrame; i++) {
+      if (cacheFrames[i].fd == fd) removeFrame(i);
     }
+    pthread_mutex_unlock(&cacheShards[s].latch);
   }
 
   // set the fd and epid to the initial state
@@ -92,41 +238,92 @@ RC PageFile::close()
 
 PageId PageFile::endPid() const 
 {
-  return epid;
+  return __atomic_load_n(&epid, __ATOMIC_ACQUIRE);
 }
 
-RC PageFile::seek(PageId pid) const
+RC PageFile::advise(int pattern) const
 {
-  return (::lseek(fd, pid * PAGE_SIZE, SEEK_SET) < 0) ? RC_FILE_SEEK_FAILED : 0;
+  if (fd <= 0) return RC_FILE_READ_FAILED;
+
+  if (map != NULL) {
+    int advice = (pattern == ACCESS_SEQUENTIAL) ? MADV_SEQUENTIAL :
+                 (pattern == ACCESS_RANDOM) ? MADV_RANDOM : MADV_NORMAL;
+    ::madvise(map, (size_t) epid * PAGE_SIZE, advice);
+  } else {
+    int advice = (pattern == ACCESS_SEQUENTIAL) ? POSIX_FADV_SEQUENTIAL :
+                 (pattern == ACCESS_RANDOM) ? POSIX_FADV_RANDOM : POSIX_FADV_NORMAL;
+    ::posix_fadvise(fd, 0, 0, advice);
+  }
+  return 0;
+}
+
+RC PageFile::prefetch(PageId pid, int count) const
+{
+  if (fd <= 0) return RC_FILE_READ_FAILED;
+
+  // do not read ahead beyond the end of the file
+  PageId end = endPid();
+  if (pid < 0 || pid >= end) return 0;
+  if (count > end - pid) count = end - pid;
+
+  if (map != NULL) {
+    ::madvise(map + (size_t) pid * PAGE_SIZE, (size_t) count * PAGE_SIZE, MADV_WILLNEED);
+  } else {
+    ::posix_fadvise(fd, (off_t) pid * PAGE_SIZE, (off_t) count * PAGE_SIZE, POSIX_FADV_WILLNEED);
+  }
+  return 0;
 }
 
 RC PageFile::write(PageId pid, const void* buffer)
 {
-  RC rc;
+  return write(pid, 1, buffer);
+}
+
+RC PageFile::write(PageId pid, int count, const void* buffer)
+{
+  RC rc = 0;
   if (pid < 0) return RC_INVALID_PID; 
+  if (count <= 0) return 0;
 
-  // seek to the location of the page
-  if ((rc = seek(pid)) < 0) return rc;
+  pthread_once(&cacheOnce, initCache);
 
-  // write the buffer to the disk page
-  if (::write(fd, buffer, PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
+  // latch the shards of all pages, in shard order, so that no page can
+  // be loaded into the pool while it is being written
+  bool latched[MAX_CACHE_SHARDS] = { false };
+  for (int i = 0; i < count; i++) latched[shardOf(hashBucket(fd, pid + i))] = true;
+  for (int s = 0; s < shardCount; s++) {
+    if (latched[s]) pthread_mutex_lock(&cacheShards[s].latch);
+  }
 
-  // if the page is in read cache, invalidate it
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid &&
-        readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-       break;
+  // write all pages at once. pwrite() does not move the file offset,
+  // so threads writing different pages do not interfere
+  size_t size = (size_t) count * PAGE_SIZE;
+  if (::pwrite(fd, buffer, size, (off_t) pid * PAGE_SIZE) != (ssize_t) size) {
+    rc = RC_FILE_WRITE_FAILED;
+  } else {
+    // update the cached copies of the pages in the buffer pool
+    for (int i = 0; i < count; i++) {
+      int frame = lookupFrame(fd, pid + i);
+      if (frame >= 0) {
+        memcpy(cacheData + (size_t) frame * PAGE_SIZE,
+               (const char*) buffer + (size_t) i * PAGE_SIZE, PAGE_SIZE);
+      }
     }
+
+    // if the written pid >= end pid, update the end pid. pages of other
+    // shards may be written at the same time, so the end pid only grows
+    PageId end = endPid();
+    while (pid + count > end && !__sync_bool_compare_and_swap(&epid, end, pid + count))
+      end = endPid();
   }
 
-  // if the written pid >= end pid, update the end pid
-  if (pid >= epid) epid = pid + 1;
+  for (int s = 0; s < shardCount; s++) {
+    if (latched[s]) pthread_mutex_unlock(&cacheShards[s].latch);
+  }
+  if (rc < 0) return rc;
 
   // increase page write count
-  writeCount++;
+  __sync_fetch_and_add(&writeCount, count);
 
   return 0;
 }
@@ -134,47 +331,82 @@ RC PageFile::write(PageId pid, const void* buffer)
 RC PageFile::read(PageId pid, void* buffer) const
 {
   RC rc;
+  const char* page;
 
-  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+  if ((rc = pin(pid, page)) < 0) return rc;
+  memcpy(buffer, page, PAGE_SIZE);
+  unpin(page);
+
+  return 0;
+}
+
+RC PageFile::pin(PageId pid, const char*& page) const
+{
+  RC rc;
+
+  if (pid < 0 || pid >= endPid()) return RC_INVALID_PID; 
+
+  // a mapped page is used right where it is mapped. whether it is in
+  // memory is not known, so every pin is counted as a page read
+  if (map != NULL) {
+    page = map + (size_t) pid * PAGE_SIZE;
+    __sync_fetch_and_add(&readCount, 1);
+    return 0;
+  }
+
+  // allocate the buffer pool if it has not been configured
+  pthread_once(&cacheOnce, initCache);
+  if (cacheCount == 0) return RC_INVALID_CACHE_SIZE;
+
+  int bucket = hashBucket(fd, pid);
+  int shard = shardOf(bucket);
+  pthread_mutex_lock(&cacheShards[shard].latch);
 
   //
-  // if the page is in cache, read it from there
+  // if the page is in the buffer pool, pin it there
   //
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid && 
-        readCache[i].lastAccessed != 0) {
-       memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
-       readCache[i].lastAccessed = ++cacheClock;
-       return 0;
-    }
+  int frame = lookupFrame(fd, pid);
+  if (frame >= 0) {
+    cacheFrames[frame].referenced = 1;
+    cacheFrames[frame].pinCount++;
+    pthread_mutex_unlock(&cacheShards[shard].latch);
+    page = cacheData + (size_t) frame * PAGE_SIZE;
+    __sync_fetch_and_add(&hitCount, 1);
+    return 0;
   }
+  __sync_fetch_and_add(&missCount, 1);
 
-  // seek to the page
-  if ((rc = seek(pid)) < 0) return rc;
-  
-  // find the cache slot to evict
-  int toEvict = 0; 
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].lastAccessed == 0) {
-      toEvict = i;
-      break;
-    }
-    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
-      toEvict = i;
-    }
-  }
-  readCache[toEvict].fd = fd;
-  readCache[toEvict].pid = pid;
-  readCache[toEvict].lastAccessed = ++cacheClock;
- 
-  // read the page to cache first and copy it to the buffer
-  if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
-    return RC_FILE_READ_FAILED;
+  // read the page into a free frame of the shard. the shard stays
+  // latched during the read so that the page is loaded only once
+  rc = 0;
+  if ((frame = evictFrame(shard)) < 0) {
+    rc = RC_BUFFER_POOL_FULL;
+  } else if (::pread(fd, cacheData + (size_t) frame * PAGE_SIZE, PAGE_SIZE, (off_t) pid * PAGE_SIZE) < 0) {
+    rc = RC_FILE_READ_FAILED;
+  } else {
+    insertFrame(frame, fd, pid);
+    cacheFrames[frame].pinCount = 1;
+    page = cacheData + (size_t) frame * PAGE_SIZE;
   }
-  memcpy(buffer, readCache[toEvict].buffer, PAGE_SIZE);
+  pthread_mutex_unlock(&cacheShards[shard].latch);
+  if (rc < 0) return rc;
 
   // increase the page read count
-  readCount++;
+  __sync_fetch_and_add(&readCount, 1);
 
   return 0;
 }
+
+void PageFile::unpin(const char* page) const
+{
+  // pages of a mapped file are never pinned
+  if (map != NULL) return;
+
+  // a pinned frame keeps its page, so its shard can be found unlatched
+  int frame = (page - cacheData) / PAGE_SIZE;
+  int shard = shardOf(hashBucket(cacheFrames[frame].fd, cacheFrames[frame].pid));
+
+  pthread_mutex_lock(&cacheShards[shard].latch);
+  cacheFrames[frame].pinCount--;
+  pthread_mutex_unlock(&cacheShards[shard].latch);
+}
@@ -10,27 +10,39 @@
 #ifndef PAGEFILE_H
 #define PAGEFILE_H
 
+#include <pthread.h>
 #include <string>
 #include "Bruinbase.h"
 
 typedef int PageId;
 
 /**
- * read/write a file in the unit of a page
+ * read/write a file in the unit of a page.
+ * pages of one file can be read and written by several threads at a time,
+ * but open() and close() must not run concurrently with other calls on the
+ * same PageFile.
  */
 class PageFile {
  public:
 
   static const int PAGE_SIZE = 1024;    // the size of a page is 1KB
 
+  // access pattern hints for advise()
+  static const int ACCESS_NORMAL     = 0;
+  static const int ACCESS_SEQUENTIAL = 1;
+  static const int ACCESS_RANDOM     = 2;
+
   PageFile();
   PageFile(const std::string& filename, char mode);
 
   /**
    * open a file in read or write mode.
    * when opened in 'w' mode, if the file does not exist, it is created.
+   * when opened in 'm' mode, the file is read-only as in 'r' mode, but it
+   * is memory-mapped and pages are served from the mapping instead of the
+   * buffer pool.
    * @param filename[IN] the name of the file to open
-   * @param mode[IN] 'r' for read, 'w' for write
+   * @param mode[IN] 'r' for read, 'w' for write, 'm' for mapped read
    * @return error code. 0 if no error
    */
   RC open(const std::string& filename, char mode);
@@ -48,6 +60,23 @@ class PageFile {
    * @return error code. 0 if no error
    */
   RC read(PageId pid, void *buffer) const;
+
+  /**
+   * pin a disk page in memory and return a pointer to it.
+   * the page stays at the returned address and is not evicted until
+   * it is unpinned. every successful pin() must be matched by an unpin()
+   * before the file is closed.
+   * @param pid[IN] the page to pin
+   * @param page[OUT] pointer to the read-only content of the page
+   * @return error code. 0 if no error
+   */
+  RC pin(PageId pid, const char*& page) const;
+
+  /**
+   * release a page pinned by pin().
+   * @param page[IN] the pointer returned by pin()
+   */
+  void unpin(const char* page) const;
   
   /**
    * write the memory buffer to the disk page.
@@ -58,6 +87,16 @@ class PageFile {
    * @return error code. 0 if no error
    */
   RC write(PageId pid, const void *buffer);
+
+  /**
+   * write count consecutive pages starting at pid with a single system call.
+   * like write(), the file is expanded if needed.
+   * @param pid[IN] the first page to write to
+   * @param count[IN] the number of pages to write
+   * @param buffer[IN] the content of the pages, one page after another
+   * @return error code. 0 if no error
+   */
+  RC write(PageId pid, int count, const void *buffer);
     
   /**
    * note the +1 part. The last page id in the file is actually endPid()-1.
@@ -66,6 +105,22 @@ class PageFile {
    */
   PageId endPid() const;
 
+  /**
+   * tell the operating system how the pages of the file will be accessed
+   * so that it can adjust read-ahead. 
+   * @param pattern[IN] ACCESS_NORMAL, ACCESS_SEQUENTIAL or ACCESS_RANDOM
+   * @return error code. 0 if no error
+   */
+  RC advise(int pattern) const;
+
+  /**
+   * ask the operating system to start reading pages in the background.
+   * @param pid[IN] the first page to read ahead
+   * @param count[IN] the number of pages to read ahead
+   * @return error code. 0 if no error
+   */
+  RC prefetch(PageId pid, int count) const;
+
   /**
    * @return the total # of disk reads
    */
@@ -76,37 +131,107 @@ class PageFile {
    */
   static int getPageWriteCount() { return writeCount; }
 
- protected:
   /**
-   * move the file cursor to the beginning of a page.
-   * this is an internal function not exposed to public.
-   * @param pid[IN] page to seek to
+   * @return the total # of page requests served from the buffer pool
+   */
+  static int getCacheHitCount()  { return hitCount; }
+
+  /**
+   * @return the total # of page requests that missed the buffer pool
+   */
+  static int getCacheMissCount() { return missCount; }
+
+  /**
+   * set the number of page frames in the buffer pool shared by all
+   * PageFiles. this should be called at startup before any file is opened
+   * and before any other thread is started;
+   * the pool is allocated with DEFAULT_CACHE_COUNT frames on first use
+   * if it has not been configured.
+   * @param frames[IN] the number of frames in the buffer pool
    * @return error code. 0 if no error
    */
-  RC seek(PageId pid) const;
+  static RC setCacheSize(int frames);
+
+  /**
+   * @return the number of page frames in the buffer pool
+   */
+  static int getCacheSize() { return cacheCount; }
 
  private:
   int     fd;     // file descriptor of the associated unix file
-  PageId  epid;   // (last page id + 1) of the file
+  PageId  epid;   // (last page id + 1) of the file. read and raised
+                  // atomically, since several threads may write pages
+  char*   map;    // the mapping of a file opened in 'm' mode (NULL if none)
 
   //
-  // the following set of members implement LRU caching 
+  // the following set of members implement the buffer pool.
+  // frames are located through a chained hash table on (fd, pid) and
+  // replaced with the CLOCK policy. a newly loaded page enters the pool
+  // with its reference bit cleared, so the pages of a one-pass scan are
+  // evicted before the pages that have been accessed more than once.
   //
-  static const int CACHE_COUNT = 10;
+  // the pool is split into shards so that threads working on different
+  // pages rarely wait for each other. every hash bucket belongs to one
+  // shard, and each shard owns a range of frames with its own clock hand,
+  // all protected by the latch of the shard.
+  //
+  static const int DEFAULT_CACHE_COUNT = 4096;
+  static const int MAX_CACHE_SHARDS = 16;  // # shards of a large pool
+  static const int MIN_SHARD_FRAMES = 64;  // # frames of a shard at least
+
+  // allocate the buffer pool with DEFAULT_CACHE_COUNT frames if it
+  // has not been configured
+  static void initCache();
+
+  // lookup the frame caching (fd, pid). -1 if the page is not cached
+  static int  lookupFrame(int fd, PageId pid);
+
+  // pick an unpinned frame of the shard to replace with the CLOCK policy
+  // and unlink it from the hash. -1 if every frame of the shard is pinned
+  static int  evictFrame(int shard);
+
+  // link the frame into the hash chain of (fd, pid)
+  static void insertFrame(int frame, int fd, PageId pid);
 
-  static int cacheClock; // clock tick counter for LRU policy
+  // unlink the frame from its hash chain and mark it empty
+  static void removeFrame(int frame);
 
-  // the actual cache data structure
+  // compute the hash bucket of (fd, pid)
+  static int  hashBucket(int fd, PageId pid);
+
+  // the shard of the hash bucket
+  static int  shardOf(int bucket) { return bucket & shardMask; }
+
+  // the metadata of a buffer pool frame
   static struct cacheStruct {
-    int    fd;              // file id of the cached page
+    int    fd;              // file id of the cached page (-1 if empty)
     PageId pid;             // page id of the cached page
-    int    lastAccessed;    // the last time the cached page was accessed
-                            //   (lastAccessed == 0) means that the buffer is empty
-    char buffer[PAGE_SIZE]; // the buffer used for caching
-  } readCache[CACHE_COUNT];
+    int    next;            // the next frame in the hash chain (-1 if last)
+    int    referenced;      // reference bit for the CLOCK policy
+    int    pinCount;        // # outstanding pins. pinned frames are not evicted
+  } *cacheFrames;
+
+  // a shard of the buffer pool
+  static struct cacheShard {
+    pthread_mutex_t latch;  // protects the frames and hash chains of the shard
+    int    firstFrame;      // the frames [firstFrame, endFrame) belong
+    int    endFrame;        //   to the shard
+    int    clockHand;       // the next frame examined by the CLOCK policy
+  } *cacheShards;
+
+  static char* cacheData;   // the page buffers. frame i is at i*PAGE_SIZE
+  static int*  cacheBuckets;// heads of the hash chains (-1 if empty)
+  static int   cacheCount;  // # frames in the pool
+  static int   bucketMask;  // (# hash buckets - 1). # buckets is a power of 2
+  static int   shardCount;  // # shards. a power of 2
+  static int   shardMask;   // (# shards - 1)
+  static pthread_once_t cacheOnce; // runs initCache() once
 
+  // the counters are updated atomically
   static int readCount;  // total # of page reads 
   static int writeCount; // total # of page writes 
+  static int hitCount;   // total # of buffer pool hits
+  static int missCount;  // total # of buffer pool misses
 };
   
 #endif // PAGEFILE_H
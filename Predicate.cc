@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include "Predicate.h"
+
+using namespace std;
+
+// the comparison of a value to a constant for every comparator
+static bool valueEQ(const char* value, const char* constant) { return strcmp(value, constant) == 0; }
+static bool valueNE(const char* value, const char* constant) { return strcmp(value, constant) != 0; }
+static bool valueLT(const char* value, const char* constant) { return strcmp(value, constant) < 0; }
+static bool valueGT(const char* value, const char* constant) { return strcmp(value, constant) > 0; }
+static bool valueLE(const char* value, const char* constant) { return strcmp(value, constant) <= 0; }
+static bool valueGE(const char* value, const char* constant) { return strcmp(value, constant) >= 0; }
+
+Predicate::Predicate()
+: lo(INT_MIN), hi(INT_MAX), keyConds(false)
+{
+}
+
+Predicate::Predicate(const vector<SelCond>& cond)
+{
+  compile(cond);
+}
+
+void Predicate::compile(const vector<SelCond>& cond)
+{
+  lo = INT_MIN;
+  hi = INT_MAX;
+  excluded.clear();
+  keyConds = false;
+  valueConds.clear();
+
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr == 1) {
+      // a constant beyond the keys an int can hold is kept just beyond
+      // them, so that the bounds below do not overflow
+      long c = atol(cond[i].value);
+      if (c < (long) INT_MIN - 1) c = (long) INT_MIN - 1;
+      if (c > (long) INT_MAX + 1) c = (long) INT_MAX + 1;
+
+      keyConds = true;
+      switch (cond[i].comp) {
+      case SelCond::EQ:
+        if (c > lo) lo = c;
+        if (c < hi) hi = c;
+        break;
+      case SelCond::NE:
+        if (c >= INT_MIN && c <= INT_MAX)
+          excluded.push_back((int) c);
+        break;
+      case SelCond::LT:
+        if (c - 1 < hi) hi = c - 1;
+        break;
+      case SelCond::GT:
+        if (c + 1 > lo) lo = c + 1;
+        break;
+      case SelCond::LE:
+        if (c < hi) hi = c;
+        break;
+      case SelCond::GE:
+        if (c > lo) lo = c;
+        break;
+      }
+    }
+    else {
+      ValueCondition vc;
+      switch (cond[i].comp) {
+      case SelCond::EQ: vc.test = valueEQ; break;
+      case SelCond::NE: vc.test = valueNE; break;
+      case SelCond::LT: vc.test = valueLT; break;
+      case SelCond::GT: vc.test = valueGT; break;
+      case SelCond::LE: vc.test = valueLE; break;
+      case SelCond::GE: vc.test = valueGE; break;
+      }
+      vc.constant = cond[i].value;
+      valueConds.push_back(vc);
+    }
+  }
+}
+
+int Predicate::filterKeys(const int* keys, int n, char* selected) const
+{
+  int count = 0;
+
+  if (lo > hi) {
+    memset(selected, 0, n);
+    return 0;
+  }
+
+  // a key is in [lo, hi] if its distance from lo, taken unsigned, is at
+  // most hi - lo
+  unsigned long width = (unsigned long) (hi - lo);
+  for (int i = 0; i < n; i++)
+    selected[i] = ((unsigned long) ((long) keys[i] - lo) <= width);
+
+  for (unsigned j = 0; j < excluded.size(); j++) {
+    int key = excluded[j];
+    for (int i = 0; i < n; i++)
+      selected[i] &= (keys[i] != key);
+  }
+
+  for (int i = 0; i < n; i++)
+    count += selected[i];
+  return count;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#ifndef PREDICATE_H
+#define PREDICATE_H
+
+#include <string>
+#include <vector>
+#include "SqlEngine.h"
+
+/**
+ * the conditions of a WHERE clause, compiled once for a query.
+ *
+ * the constants are parsed when the conditions are compiled. the
+ * conditions on key are folded into a range [lo, hi] and a list of keys
+ * to exclude, and every condition on value keeps a comparison function
+ * picked by its comparator, so checking a tuple neither parses a constant
+ * nor switches on a comparator.
+ */
+class Predicate {
+ public:
+  Predicate();
+
+  /**
+   * compile the conditions, which are all ANDed together.
+   * @param cond[IN] the conditions of the WHERE clause
+   */
+  explicit Predicate(const std::vector<SelCond>& cond);
+
+  /**
+   * compile the conditions in place of the current ones.
+   * @param cond[IN] the conditions of the WHERE clause
+   */
+  void compile(const std::vector<SelCond>& cond);
+
+  /**
+   * @return true if there is a condition on key
+   */
+  bool hasKeyConditions() const { return keyConds; }
+
+  /**
+   * @return true if there is a condition on value
+   */
+  bool hasValueConditions() const { return !valueConds.empty(); }
+
+  /**
+   * check the conditions on key.
+   * @param key[IN] the key of the tuple
+   * @return true if the key meets every condition on key
+   */
+  bool matchKey(int key) const
+  {
+    if (key < lo || key > hi) return false;
+    for (unsigned i = 0; i < excluded.size(); i++)
+      if (key == excluded[i]) return false;
+    return true;
+  }
+
+  /**
+   * check the conditions on value.
+   * @param value[IN] the value of the tuple
+   * @return true if the value meets every condition on value
+   */
+  bool matchValue(const std::string& value) const
+  {
+    for (unsigned i = 0; i < valueConds.size(); i++)
+      if (!valueConds[i].test(value.c_str(), valueConds[i].constant.c_str()))
+        return false;
+    return true;
+  }
+
+  /**
+   * check all conditions.
+   * @param key[IN] the key of the tuple
+   * @param value[IN] the value of the tuple
+   * @return true if the tuple meets every condition
+   */
+  bool match(int key, const std::string& value) const
+  {
+    return matchKey(key) && matchValue(value);
+  }
+
+  /**
+   * check the conditions on key for an array of keys at once, without a
+   * branch per key.
+   * @param keys[IN] the keys to check
+   * @param n[IN] # keys
+   * @param selected[OUT] n bytes. 1 for a key meeting the conditions, 0
+   *                      for the others
+   * @return # keys meeting the conditions
+   */
+  int filterKeys(const int* keys, int n, char* selected) const;
+
+ private:
+  // compares a value to the constant of a condition
+  typedef bool (*ValueTest)(const char* value, const char* constant);
+
+  typedef struct {
+    ValueTest   test;     // the comparison of the condition
+    std::string constant; // the constant of the condition
+  } ValueCondition;
+
+  long lo, hi;                           // the range of keys allowed
+  std::vector<int> excluded;             // the keys of the NE conditions
+  bool keyConds;                         // true if a condition is on key
+  std::vector<ValueCondition> valueConds; // the conditions on value
+};
+
+#endif /* PREDICATE_H */
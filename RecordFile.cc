@@ -9,10 +9,39 @@
 
 #include "Bruinbase.h"
 #include "RecordFile.h"
+#include <algorithm>
+#include <climits>
 #include <cstring>
 
 using std::string;
 
+// identifies page 0 of a zone map
+static const int ZONE_MAGIC = 0x50414d5a; // "ZMAP"
+
+// # zones in a page of the zone map. page 0 holds [magic][# zones] and
+// the zones are kept from page 1 on
+static const int ZONES_PER_PAGE = PageFile::PAGE_SIZE / sizeof(Zone);
+
+// marks the format of a page in the upper half of its first four bytes.
+// a page of the earliest format of fixed slots has zeros there.
+static const int SLOTTED_PAGE_MAGIC = 0x5350; // "SP"
+static const int PAX_PAGE_MAGIC = 0x5850;     // "PX"
+
+// # bytes of a slot of a slotted page: the offset and the length of a
+// record
+static const int SLOT_SIZE = 2 * sizeof(unsigned short);
+
+// set in the length of a slot of a slotted page whose record keeps the
+// code of its value in the dictionary in place of the value
+static const unsigned short CODED_VALUE_FLAG = 0x8000;
+
+// # bytes at the start of a PAX page: # records and the format, the
+// smallest key and the width of the keys
+static const int PAX_HEADER_SIZE = 3 * sizeof(int);
+
+// # bytes of a fixed slot in a page of the earlier format
+static const int FIXED_SLOT_SIZE = sizeof(int) + 100;
+
 //
 // helper functions for page manipultation
 //
@@ -21,10 +50,33 @@ using std::string;
 static char* slotPtr(char* page, int n);
 
 // read the record in the n'th slot in the page
-static void readSlot(const char* page, int n, int& key, std::string& value);
+// @return the code of the value if the record keeps it in place of the
+//         value. -1 if value has been read
+static int readSlot(const char* page, int n, int& key, std::string& value);
+
+// read the key of the record in the n'th slot in the page
+static int readKey(const char* page, int n);
 
-// write the record to the n'th slot in the page
-static void writeSlot(char* page, int n, int key, const std::string& value);
+// read the keys of the records in the slots [from, to) of the page
+static void readKeys(const char* page, int from, int to, int* keys);
+
+// add the record to the next slot of a PAX page, unless it is full.
+// the record keeps the code if it is not -1, and the value otherwise
+// @return false if the record does not fit in the page
+static bool addRecord(char* page, int key, const std::string& value, int code);
+
+// make an empty PAX page
+static void initPage(char* page);
+
+// the format of the page: PAX_PAGE_MAGIC, SLOTTED_PAGE_MAGIC or 0
+static int getPageFormat(const char* page);
+
+// store n at p in 1-5 bytes of 7 bits each, the lowest first
+// @return # bytes used
+static int putVarint(char* p, unsigned n);
+
+// read a number stored by putVarint() at p and move p past it
+static unsigned getVarint(const char*& p);
 
 // get # records stored in the page
 static int getRecordCount(const char* page);
@@ -32,6 +84,16 @@ static int getRecordCount(const char* page);
 // update # records stored in the page
 static void setRecordCount(char* page, int count);
 
+//
+// helper functions for the zone map
+//
+
+// make the zone of an extent without records
+static void clearZone(Zone& zone);
+
+// the leading bytes of the value kept in a zone, padded with zeros
+static void valuePrefix(const std::string& value, char* prefix);
+
 
 //
 // helper functions for RecordId manipulation
@@ -104,16 +166,25 @@ bool operator != (const RecordId& r1, const RecordId& r2)
 
 
 RecordFile::RecordFile()
+: zonesRead(false)
 {
   erid.pid = 0;
   erid.sid = 0;
+  pthread_mutex_init(&zoneMutex, NULL);
 }
 
 RecordFile::RecordFile(const string& filename, char mode)
+: zonesRead(false)
 {
+  pthread_mutex_init(&zoneMutex, NULL);
   open(filename, mode);
 }
 
+RecordFile::~RecordFile()
+{
+  pthread_mutex_destroy(&zoneMutex);
+}
+
 RC RecordFile::open(const string& filename, char mode)
 {
   RC   rc;
@@ -121,6 +192,15 @@ RC RecordFile::open(const string& filename, char mode)
 
   // open the page file
   if ((rc = pf.open(filename, mode)) < 0) return rc;
+
+  // the zone map is read when it is first needed. a table without one
+  // under 'r' mode is scanned in full
+  zf.open(filename + ".zm", mode);
+  zones.clear();
+  zonesRead = false;
+
+  // a table without a dictionary under 'r' mode has no codes to look up
+  dict.open(filename + ".dict", mode);
   
   //
   // in the rest of this function, we set the end record id
@@ -143,16 +223,14 @@ RC RecordFile::open(const string& filename, char mode)
     // an error occurred during page read
     erid.pid = erid.sid = 0;
     pf.close();
+    zf.close();
+    dict.close();
     return rc;
   }
 
-  // get # records in the last page
+  // get # records in the last page. whether the next record fits in
+  // the page is checked when it is appended.
   erid.sid = getRecordCount(page);
-  if (erid.sid >= RECORDS_PER_PAGE) {
-    // the last page is full. advance the end record id to the next page.
-    erid.pid++;
-    erid.sid = 0;
-  }
   
   return 0;
 }
@@ -162,25 +240,93 @@ RC RecordFile::close()
   erid.pid = 0;
   erid.sid = 0;
 
+  zf.close();
+  zones.clear();
+  zonesRead = false;
+  dict.close();
   return pf.close();
 }
 
 RC RecordFile::read(const RecordId& rid, int& key, string& value) const
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  const char* page;
   
   // check whether the rid is in the valid range
   if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
   if (rid.sid < 0 || rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
   if (rid >= erid) return RC_INVALID_RID;
   
-  // read the page containing the record
-  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  // pin the page containing the record
+  if ((rc = pf.pin(rid.pid, page)) < 0) return rc;
+
+  // a page may hold fewer records than the last one
+  if (rid.sid >= getRecordCount(page)) {
+    pf.unpin(page);
+    return RC_INVALID_RID;
+  }
 
   // read the record from the slot in the page
-  readSlot(page, rid.sid, key, value);
+  rc = readRecord(page, rid.sid, key, value);
+
+  pf.unpin(page);
+  return rc;
+}
+
+// orders positions in a list of record ids by the record ids
+struct RidOrder {
+  const std::vector<RecordId>& rids;
+  RidOrder(const std::vector<RecordId>& rids) : rids(rids) {}
+  bool operator() (unsigned i, unsigned j) const { return rids[i] < rids[j]; }
+};
+
+RC RecordFile::readBatch(const std::vector<RecordId>& rids, std::vector<int>& keys,
+                         std::vector<std::string>& values) const
+{
+  RC   rc;
+  const char* page = NULL;
+  PageId      pid = -1;
+  std::vector<unsigned> order(rids.size());
+
+  keys.resize(rids.size());
+  values.resize(rids.size());
+
+  // visit the records in the order of their ids
+  for (unsigned i = 0; i < rids.size(); i++) {
+    if (rids[i].pid < 0 || rids[i].sid < 0 || rids[i].sid >= RECORDS_PER_PAGE ||
+        rids[i] >= erid)
+      return RC_INVALID_RID;
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), RidOrder(rids));
 
+  // ask for every run of consecutive pages ahead of reading them
+  for (unsigned i = 0; i < order.size(); ) {
+    PageId first = rids[order[i]].pid, last = first;
+    while (++i < order.size() && rids[order[i]].pid <= last + 1)
+      last = rids[order[i]].pid;
+    pf.prefetch(first, last - first + 1);
+  }
+
+  // read the records, pinning every page once
+  for (unsigned i = 0; i < order.size(); i++) {
+    const RecordId& rid = rids[order[i]];
+    if (rid.pid != pid) {
+      if (page != NULL) pf.unpin(page);
+      if ((rc = pf.pin(rid.pid, page)) < 0) return rc;
+      pid = rid.pid;
+    }
+    if (rid.sid >= getRecordCount(page)) {
+      pf.unpin(page);
+      return RC_INVALID_RID;
+    }
+    if ((rc = readRecord(page, rid.sid, keys[order[i]], values[order[i]])) < 0) {
+      pf.unpin(page);
+      return rc;
+    }
+  }
+
+  if (page != NULL) pf.unpin(page);
   return 0;
 }
 
@@ -188,32 +334,114 @@ RC RecordFile::append(int key, const std::string& value, RecordId& rid)
 {
   RC   rc;
   char page[PageFile::PAGE_SIZE];
+  int  code = encodeValue(value);
 
   // unless we are writing to the the first slot of an empty page,
-  // we have to read the page first
+  // we have to read the page first. a page of an earlier format or
+  // without room for the record is left as it is.
   if (erid.sid > 0) {
     if ((rc = pf.read(erid.pid, page)) < 0) return rc;
-  } else {
-    // if this is the first slot of an empty page
-    // we can simply initialize the page with zeros
-    memset(page, 0, PageFile::PAGE_SIZE);
+    if (getPageFormat(page) != PAX_PAGE_MAGIC || !addRecord(page, key, value, code)) {
+      erid.pid++;
+      erid.sid = 0;
+    }
   }
-    
-  // write the record to the first empty slot 
-  writeSlot(page, erid.sid, key, value);
 
-  // the first four bytes in the page stores # records in the page.
-  // update this number.
-  setRecordCount(page, erid.sid + 1);
+  // if this is the first slot of an empty page
+  // we can simply initialize the page
+  if (erid.sid == 0) {
+    initPage(page);
+    addRecord(page, key, value, code);
+  }
+
+  // the page may refer to a value just added to the dictionary
+  if ((rc = dict.flush()) < 0) return rc;
 
   // write the page to the disk
   if ((rc = pf.write(erid.pid, page)) < 0) return rc;
+  if ((rc = updateZones(erid.pid, erid.pid + 1, page)) < 0) return rc;
     
   // we need to output the rid of the record slot
   rid = erid;
 
   // advance the end record id by one to the next empty slot
-  ++erid;
+  erid.sid++;
+
+  return 0;
+}
+
+RC RecordFile::appendBatch(const std::vector<std::pair<int, std::string> >& records,
+                          std::vector<RecordId>& rids)
+{
+  RC     rc;
+  size_t i = 0;
+  std::vector<char> pages((size_t) APPEND_BATCH_PAGES * PageFile::PAGE_SIZE);
+  std::vector<int>  codes(records.size());
+
+  rids.clear();
+  rids.reserve(records.size());
+
+  // find the records that keep the code of their value
+  for (size_t n = 0; n < records.size(); n++)
+    codes[n] = encodeValue(records[n].second);
+  if ((rc = dict.flush()) < 0) return rc;
+
+  while (i < records.size()) {
+    RecordId start = erid;  // the end record id before this batch of pages
+    PageId   first;         // the first page of this batch
+    size_t   done = i;      // # records stored before this batch of pages
+    int      npages = 0;
+
+    // unless we start at the first slot of an empty page, we have to read
+    // the page first. a page of the earlier format or without room for the
+    // next record is left as it is.
+    if (erid.sid > 0) {
+      if ((rc = pf.read(erid.pid, &pages[0])) < 0) {
+        rids.resize(done);
+        return rc;
+      }
+      if (getPageFormat(&pages[0]) != PAX_PAGE_MAGIC ||
+          !addRecord(&pages[0], records[i].first, records[i].second, codes[i])) {
+        erid.pid++;
+        erid.sid = 0;
+      }
+      else {
+        rids.push_back(erid);
+        i++;
+        erid.sid++;
+      }
+    }
+    first = erid.pid;
+
+    // fill up to APPEND_BATCH_PAGES pages in memory
+    do {
+      char* page = &pages[(size_t) npages * PageFile::PAGE_SIZE];
+      if (erid.sid == 0) initPage(page);
+
+      // fill the page. an empty page holds any record.
+      while (i < records.size() && addRecord(page, records[i].first, records[i].second, codes[i])) {
+        rids.push_back(erid);
+        i++;
+        erid.sid++;
+      }
+      npages++;
+
+      // advance the end record id to the next page if this one is full
+      if (i < records.size()) {
+        erid.pid++;
+        erid.sid = 0;
+      }
+    } while (i < records.size() && npages < APPEND_BATCH_PAGES);
+
+    // write all filled pages at once
+    if ((rc = pf.write(first, npages, &pages[0])) < 0) {
+      erid = start;
+      rids.resize(done);
+      return rc;
+    }
+    if ((rc = updateZones(first, first + npages, &pages[0])) < 0)
+      return rc;
+  }
 
   return 0;
 }
@@ -223,56 +451,576 @@ const RecordId& RecordFile::endRid() const
   return erid;
 }
 
+RC RecordFile::advise(int pattern) const
+{
+  return pf.advise(pattern);
+}
+
+RC RecordFile::readRecord(const char* page, int n, int& key, string& value) const
+{
+  int code = readSlot(page, n, key, value);
+  return (code < 0) ? 0 : dict.lookup(code, value);
+}
+
+int RecordFile::encodeValue(const string& value)
+{
+  int code;
+  int length = std::min<size_t>(value.size(), MAX_VALUE_LENGTH);
+  string stored(value, 0, length);
+  char buffer[5];
+
+  // a value seen before is replaced by its code if the code is shorter.
+  // the record keeps a byte to tell a value from a code.
+  if (dict.find(stored, code))
+    return (putVarint(buffer, code + 1) < length + 1) ? code : -1;
+
+  // a value is added once it repeats, as a value met only once would be
+  // kept in the table and the dictionary both. a value too short to be
+  // replaced by a code is not kept
+  if (length > 2 && dict.repeats(stored))
+    dict.add(stored, code);
+  return -1;
+}
+
+RC RecordFile::readZones() const
+{
+  RC   rc = 0;
+  char page[PageFile::PAGE_SIZE];
+  int  magic, count;
+
+  pthread_mutex_lock(&zoneMutex);
+  if (!zonesRead && zf.endPid() > 0 && (rc = zf.read(0, page)) == 0) {
+    memcpy(&magic, page, sizeof(int));
+    memcpy(&count, page + sizeof(int), sizeof(int));
+    if (magic == ZONE_MAGIC && count >= 0 && count <= (zf.endPid() - 1) * ZONES_PER_PAGE) {
+      zones.resize(count);
+      for (int i = 0; i < count && rc == 0; i += ZONES_PER_PAGE) {
+        if ((rc = zf.read(1 + i / ZONES_PER_PAGE, page)) == 0)
+          memcpy(&zones[i], page, std::min(ZONES_PER_PAGE, count - i) * sizeof(Zone));
+      }
+    }
+  }
+  if (rc < 0) zones.clear();
+  zonesRead = true;
+  pthread_mutex_unlock(&zoneMutex);
+  return rc;
+}
+
+RC RecordFile::updateZones(PageId from, PageId to, const char* pages)
+{
+  RC       rc;
+  char     page[PageFile::PAGE_SIZE];
+  unsigned changed;
+  int      count;
+  Zone     empty;
+
+  readZones();
+  clearZone(empty);
+
+  // a table written before it had a zone map gets the zones of its
+  // earlier pages first
+  changed = std::min<unsigned>(zones.size(), from / ZONE_PAGES);
+  for (PageId pid = zones.size() * ZONE_PAGES; pid < from; pid++) {
+    if ((rc = pf.read(pid, page)) < 0) return rc;
+    if (zones.size() <= (unsigned) pid / ZONE_PAGES) zones.push_back(empty);
+    if ((rc = addToZone(zones[pid / ZONE_PAGES], page)) < 0) return rc;
+  }
+  for (PageId pid = from; pid < to; pid++) {
+    if (zones.size() <= (unsigned) pid / ZONE_PAGES) zones.push_back(empty);
+    rc = addToZone(zones[pid / ZONE_PAGES], pages + (size_t) (pid - from) * PageFile::PAGE_SIZE);
+    if (rc < 0) return rc;
+  }
+
+  // write the zone map pages from the first changed zone on
+  for (unsigned i = changed - changed % ZONES_PER_PAGE; i < zones.size(); i += ZONES_PER_PAGE) {
+    memset(page, 0, PageFile::PAGE_SIZE);
+    memcpy(page, &zones[i], std::min<unsigned>(ZONES_PER_PAGE, zones.size() - i) * sizeof(Zone));
+    if ((rc = zf.write(1 + i / ZONES_PER_PAGE, page)) < 0) return rc;
+  }
+
+  memset(page, 0, PageFile::PAGE_SIZE);
+  count = zones.size();
+  memcpy(page, &ZONE_MAGIC, sizeof(int));
+  memcpy(page + sizeof(int), &count, sizeof(int));
+  return zf.write(0, page);
+}
+
+bool RecordFile::mayMatch(PageId pid, const ScanBounds& bounds) const
+{
+  char prefix[ZONE_PREFIX_SIZE];
+
+  readZones();
+  if ((unsigned) pid / ZONE_PAGES >= zones.size())
+    return true;
+  const Zone& zone = zones[pid / ZONE_PAGES];
+
+  if (zone.maxKey < bounds.loKey || zone.minKey > bounds.hiKey)
+    return false;
+
+  // the prefixes keep the order of the values, though not strictly
+  valuePrefix(bounds.loValue, prefix);
+  if (memcmp(zone.maxValue, prefix, sizeof(prefix)) < 0)
+    return false;
+  if (bounds.hasHiValue) {
+    valuePrefix(bounds.hiValue, prefix);
+    if (memcmp(zone.minValue, prefix, sizeof(prefix)) > 0)
+      return false;
+  }
+  return true;
+}
+
+RecordScan::RecordScan()
+: rf(NULL), page(NULL), count(0), ahead(0), bounded(false)
+{
+  rid.pid = rid.sid = 0;
+}
+
+RecordScan::~RecordScan()
+{
+  close();
+}
+
+RC RecordScan::open(const RecordFile& file)
+{
+  close();
+
+  rf = &file;
+  rid.pid = rid.sid = 0;
+  count = 0;
+  ahead = 0;
+  endPid = file.endRid().pid + 1;
+  bounded = false;
+  return 0;
+}
+
+RC RecordScan::open(const RecordFile& file, const ScanBounds& scanBounds)
+{
+  open(file);
+  bounded = true;
+  bounds = scanBounds;
+  return file.readZones();
+}
+
+RC RecordScan::open(const RecordFile& file, const ScanBounds& scanBounds, PageId first, PageId end)
+{
+  RC rc = open(file, scanBounds);
+
+  rid.pid = ahead = first;
+  if (end < endPid) endPid = end;
+  return rc;
+}
+
+void RecordScan::skipExtents()
+{
+  while (rid < rf->endRid() && rid.pid < endPid && !rf->mayMatch(rid.pid, bounds)) {
+    rid.pid = (rid.pid / RecordFile::ZONE_PAGES + 1) * RecordFile::ZONE_PAGES;
+    rid.sid = 0;
+  }
+}
+
+void RecordScan::close()
+{
+  if (page != NULL) {
+    rf->pf.unpin(page);
+    page = NULL;
+  }
+}
+
+RC RecordScan::loadPage(PageId pid)
+{
+  RC rc;
+
+  close();
+
+  // keep READ_AHEAD_PAGES pages in flight ahead of the scan. the next
+  // batch is requested when the scan gets halfway through the current one.
+  // a bounded scan reads ahead within its extent, as the next one may
+  // be skipped
+  if (bounded) {
+    if (pid >= ahead) {
+      ahead = (pid / RecordFile::ZONE_PAGES + 1) * RecordFile::ZONE_PAGES;
+      rf->pf.prefetch(pid, ahead - pid);
+    }
+  }
+  else if (pid + READ_AHEAD_PAGES / 2 >= ahead) {
+    if (ahead < pid) ahead = pid;
+    rf->pf.prefetch(ahead, READ_AHEAD_PAGES);
+    ahead += READ_AHEAD_PAGES;
+  }
+
+  if ((rc = rf->pf.pin(pid, page)) < 0) {
+    page = NULL;
+    return rc;
+  }
+  count = getRecordCount(page);
+  return 0;
+}
+
+RC RecordScan::seekRecord()
+{
+  RC rc;
+
+  if (rf == NULL) return RC_INVALID_CURSOR;
+
+  // move to the next page when the current one is exhausted
+  while (page == NULL || rid.sid >= count) {
+    bool first = (page == NULL);
+    if (!first) {
+      rid.pid++;
+      rid.sid = 0;
+    }
+    // an extent is skipped as a whole when the scan enters it
+    if (bounded && (first || rid.pid % RecordFile::ZONE_PAGES == 0))
+      skipExtents();
+    if (rid >= rf->endRid() || rid.pid >= endPid) {
+      close();
+      return RC_END_OF_FILE;
+    }
+    if ((rc = loadPage(rid.pid)) < 0) return rc;
+  }
+  return 0;
+}
+
+RC RecordScan::next(RecordId& outRid, int& key, string& value)
+{
+  RC rc;
+
+  if ((rc = seekRecord()) < 0) return rc;
+
+  // the value is decoded for this record alone
+  if ((rc = rf->readRecord(page, rid.sid, key, value)) < 0) return rc;
+  outRid = rid;
+  rid.sid++;
+  return 0;
+}
+
+RC RecordScan::nextKeys(RecordId& outRid, std::vector<int>& keys)
+{
+  RC rc;
+
+  if ((rc = seekRecord()) < 0) return rc;
+
+  keys.resize(count - rid.sid);
+  readKeys(page, rid.sid, count, &keys[0]);
+  outRid = rid;
+  rid.sid = count;
+  return 0;
+}
+
+RC RecordScan::readValue(int sid, string& value) const
+{
+  int key;
+
+  if (page == NULL || sid < 0 || sid >= count) return RC_INVALID_RID;
+  return rf->readRecord(page, sid, key, value);
+}
+
+RC RecordScan::next(RecordId& outRid, int& key)
+{
+  RC rc;
+
+  if ((rc = seekRecord()) < 0) return rc;
+
+  key = readKey(page, rid.sid);
+  outRid = rid;
+  rid.sid++;
+  return 0;
+}
+
 static int getRecordCount(const char* page)
 {
   int count;
 
-  // the first four bytes of a page contains # records in the page
+  // the lower half of the first four bytes of a page contains # records
+  // in the page
   memcpy(&count, page, sizeof(int));
-  return count;
+  return count & 0xffff;
 }
 
 static void setRecordCount(char* page, int count)
 {
-  // the first four bytes of a page contains # records in the page
+  // the upper half of the first four bytes keeps the format of the page.
+  // records are only added to PAX pages
+  count |= PAX_PAGE_MAGIC << 16;
   memcpy(page, &count, sizeof(int));
 }
 
+static int getPageFormat(const char* page)
+{
+  int header;
+
+  memcpy(&header, page, sizeof(int));
+  return header >> 16;
+}
+
+static void initPage(char* page)
+{
+  memset(page, 0, PageFile::PAGE_SIZE);
+  setRecordCount(page, 0);
+}
+
+static void clearZone(Zone& zone)
+{
+  zone.minKey = INT_MAX;
+  zone.maxKey = INT_MIN;
+  memset(zone.minValue, 0xff, sizeof(zone.minValue));
+  memset(zone.maxValue, 0, sizeof(zone.maxValue));
+}
+
+RC RecordFile::addToZone(Zone& zone, const char* page) const
+{
+  RC     rc;
+  int    key;
+  string value;
+  char   prefix[ZONE_PREFIX_SIZE];
+
+  for (int n = 0; n < getRecordCount(page); n++) {
+    if ((rc = readRecord(page, n, key, value)) < 0) return rc;
+    if (key < zone.minKey) zone.minKey = key;
+    if (key > zone.maxKey) zone.maxKey = key;
+
+    valuePrefix(value, prefix);
+    if (memcmp(prefix, zone.minValue, sizeof(prefix)) < 0)
+      memcpy(zone.minValue, prefix, sizeof(prefix));
+    if (memcmp(prefix, zone.maxValue, sizeof(prefix)) > 0)
+      memcpy(zone.maxValue, prefix, sizeof(prefix));
+  }
+  return 0;
+}
+
+static void valuePrefix(const std::string& value, char* prefix)
+{
+  memset(prefix, 0, ZONE_PREFIX_SIZE);
+  memcpy(prefix, value.data(), std::min<size_t>(value.size(), ZONE_PREFIX_SIZE));
+}
+
+// the width in bytes of the keys of a PAX page
+static int keyWidth(const char* page)
+{
+  int width;
+  memcpy(&width, page + 2 * sizeof(int), sizeof(int));
+  return width;
+}
+
+// the smallest key of a PAX page, which the keys are kept relative to
+static int baseKey(const char* page)
+{
+  int key;
+  memcpy(&key, page + sizeof(int), sizeof(int));
+  return key;
+}
+
+// the width in bytes that keeps the difference of any key in [lo, hi]
+// from lo
+static int widthOf(int lo, int hi)
+{
+  unsigned range = (unsigned) hi - (unsigned) lo;
+  return (range <= 0xff) ? 1 : (range <= 0xffff) ? 2 : sizeof(int);
+}
+
 static char* slotPtr(char* page, int n) 
 {
   // compute the location of the n'th slot in a page.
   // remember that the first four bytes in a page is used to store
-  // # records in the page and each slot consists of an integer and
-  // a string of length MAX_VALUE_LENGTH
-  return (page+sizeof(int)) + (sizeof(int)+RecordFile::MAX_VALUE_LENGTH)*n;
+  // # records in the page
+  switch (getPageFormat(page)) {
+  case PAX_PAGE_MAGIC:
+    // the slot of a PAX page is the offset of the value, after the keys
+    return (page+PAX_HEADER_SIZE) + keyWidth(page)*getRecordCount(page) + sizeof(unsigned short)*n;
+  case SLOTTED_PAGE_MAGIC:
+    return (page+sizeof(int)) + SLOT_SIZE*n;
+  }
+
+  // a page of the earliest format has fixed slots of an integer and a
+  // null-terminated string of 100 bytes
+  return (page+sizeof(int)) + FIXED_SLOT_SIZE*n;
+}
+
+// the first and the last + 1 byte of the n'th value of a PAX page. the
+// values are packed downwards from the end of the page in the order of
+// their slots, so a value ends where the one before it starts
+static void valueSpan(const char* page, int n, const char*& begin, const char*& end)
+{
+  unsigned short offset;
+
+  memcpy(&offset, slotPtr(const_cast<char*>(page), n), sizeof(offset));
+  begin = page + offset;
+  if (n == 0) {
+    end = page + PageFile::PAGE_SIZE;
+  } else {
+    memcpy(&offset, slotPtr(const_cast<char*>(page), n - 1), sizeof(offset));
+    end = page + offset;
+  }
 }
 
-static void readSlot(const char* page, int n, int& key, std::string& value)
+static int readSlot(const char* page, int n, int& key, std::string& value)
 {
-  // compute the location of the record
+  // compute the location of the slot
   char *ptr = slotPtr(const_cast<char*>(page), n);
+  unsigned short offset, length;
 
-  // read the key 
-  memcpy(&key, ptr, sizeof(int));
+  switch (getPageFormat(page)) {
+  case PAX_PAGE_MAGIC: {
+    const char *p, *end;
+    key = readKey(page, n);
+    valueSpan(page, n, p, end);
+
+    // a value is kept as 0 and its bytes, or as the code of the value + 1
+    unsigned tag = getVarint(p);
+    if (tag > 0)
+      return tag - 1;
+    value.assign(p, end - p);
+    return -1;
+  }
+
+  case SLOTTED_PAGE_MAGIC: {
+    // find the record from its slot
+    memcpy(&offset, ptr, sizeof(offset));
+    memcpy(&length, ptr + sizeof(offset), sizeof(length));
+    memcpy(&key, page + offset, sizeof(int));
 
-  // read the value
+    // the record keeps the value, or the code of the value
+    const char* p = page + offset + sizeof(int);
+    if (length & CODED_VALUE_FLAG)
+      return getVarint(p);
+    value.assign(p, length);
+    return -1;
+  }
+  }
+
+  memcpy(&key, ptr, sizeof(int));
   value.assign(ptr + sizeof(int));
+  return -1;
+}
+
+static int readKey(const char* page, int n)
+{
+  int key;
+  readKeys(page, n, n + 1, &key);
+  return key;
 }
 
-static void writeSlot(char* page, int n, int key, const std::string& value)
+static void readKeys(const char* page, int from, int to, int* keys)
 {
-  // compute the location of the record
-  char *ptr = slotPtr(page, n);
+  // the keys of a PAX page are an array of differences from the base key,
+  // decoded in one tight loop for every width
+  if (getPageFormat(page) == PAX_PAGE_MAGIC) {
+    const unsigned char* p = (const unsigned char*) page + PAX_HEADER_SIZE;
+    unsigned base = baseKey(page);
+    unsigned short u16;
+    unsigned u32;
 
-  // store the key
-  memcpy(ptr, &key, sizeof(int));
+    switch (keyWidth(page)) {
+    case 1:
+      for (int n = from; n < to; n++)
+        keys[n - from] = (int) (base + p[n]);
+      break;
+    case 2:
+      for (int n = from; n < to; n++) {
+        memcpy(&u16, p + 2 * n, sizeof(u16));
+        keys[n - from] = (int) (base + u16);
+      }
+      break;
+    default:
+      for (int n = from; n < to; n++) {
+        memcpy(&u32, p + 4 * n, sizeof(u32));
+        keys[n - from] = (int) (base + u32);
+      }
+      break;
+    }
+    return;
+  }
+
+  for (int n = from; n < to; n++) {
+    char *ptr = slotPtr(const_cast<char*>(page), n);
+    unsigned short offset;
+
+    if (getPageFormat(page) == SLOTTED_PAGE_MAGIC) {
+      memcpy(&offset, ptr, sizeof(offset));
+      ptr = const_cast<char*>(page) + offset;
+    }
+    memcpy(&keys[n - from], ptr, sizeof(int));
+  }
+}
+
+static bool addRecord(char* page, int key, const std::string& value, int code)
+{
+  int  count = getRecordCount(page);
+  int  lo = key, hi = key;
+  unsigned short offset = PageFile::PAGE_SIZE;
+  char entry[PageFile::PAGE_SIZE];
+  char *p = entry;
 
-  // store the value. 
-  if ((int)value.size() >= RecordFile::MAX_VALUE_LENGTH) {
-    // when the string is longer than MAX_VALUE_LENGTH, truncate it.
-    memcpy(ptr + sizeof(int), value.c_str(), RecordFile::MAX_VALUE_LENGTH -1);
-    *(ptr + sizeof(int) + RecordFile::MAX_VALUE_LENGTH - 1) = 0;
+  // encode the value, or its code. when the string is longer than
+  // MAX_VALUE_LENGTH, truncate it.
+  if (code >= 0) {
+    p += putVarint(p, code + 1);
   } else {
-    strcpy(ptr + sizeof(int), value.c_str());
+    size_t length = std::min<size_t>(value.size(), RecordFile::MAX_VALUE_LENGTH);
+    *p++ = 0;
+    memcpy(p, value.data(), length);
+    p += length;
+  }
+
+  // the keys and the slots are rewritten, as the new key may need wider
+  // differences from a new base key. the values stay where they are.
+  std::vector<int> keys(count + 1);
+  std::vector<unsigned short> slots(count + 1);
+  readKeys(page, 0, count, &keys[0]);
+  if (count > 0)
+    memcpy(&slots[0], slotPtr(page, 0), sizeof(unsigned short) * count);
+  keys[count] = key;
+  for (int n = 0; n < count; n++) {
+    lo = std::min(lo, keys[n]);
+    hi = std::max(hi, keys[n]);
+  }
+  int width = widthOf(lo, hi);
+
+  // the free space lies between the slots and the last value
+  if (count > 0)
+    offset = slots[count - 1];
+  if (offset - (PAX_HEADER_SIZE + (width + (int) sizeof(offset)) * (count + 1)) < p - entry)
+    return false;
+
+  // store the value
+  offset -= p - entry;
+  memcpy(page + offset, entry, p - entry);
+  slots[count] = offset;
+
+  // store the keys and then the slots
+  char* q = page + PAX_HEADER_SIZE;
+  for (int n = 0; n <= count; n++, q += width) {
+    unsigned diff = (unsigned) keys[n] - (unsigned) lo;
+    unsigned char u8 = diff;
+    unsigned short u16 = diff;
+    if (width == 1) memcpy(q, &u8, 1);
+    else if (width == 2) memcpy(q, &u16, 2);
+    else memcpy(q, &diff, 4);
+  }
+  memcpy(q, &slots[0], sizeof(unsigned short) * (count + 1));
+  memcpy(page + sizeof(int), &lo, sizeof(int));
+  memcpy(page + 2 * sizeof(int), &width, sizeof(int));
+
+  setRecordCount(page, count + 1);
+  return true;
+}
+
+static int putVarint(char* p, unsigned n)
+{
+  int size = 1;
+  for (; n >= 0x80; n >>= 7, size++)
+    *p++ = (char) (n | 0x80);
+  *p = (char) n;
+  return size;
+}
+
+static unsigned getVarint(const char*& p)
+{
+  unsigned n = 0;
+  for (int shift = 0; ; shift += 7) {
+    unsigned char byte = *p++;
+    n |= (unsigned) (byte & 0x7f) << shift;
+    if (byte < 0x80)
+      return n;
   }
 }
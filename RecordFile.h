@@ -10,8 +10,12 @@
 #ifndef RECORDFILE_H
 #define RECORDFILE_H
 
+#include <pthread.h>
 #include <string>
+#include <utility>
+#include <vector>
 #include "PageFile.h"
+#include "ValueDictionary.h"
 
 /**
  * The data structure for pointing to a particular record in a RecordFile.
@@ -38,26 +42,82 @@ bool operator<= (const RecordId& r1, const RecordId& r2);
 bool operator== (const RecordId& r1, const RecordId& r2);
 bool operator!= (const RecordId& r1, const RecordId& r2);
 
+// # leading bytes of the values kept in a zone
+const int ZONE_PREFIX_SIZE = 8;
+
+/**
+ * the summary of an extent of a RecordFile kept in its zone map: the
+ * smallest and the largest key, and the leading bytes of the smallest and
+ * the largest value (padded with zeros) of the records in the extent.
+ */
+typedef struct {
+  int  minKey;
+  int  maxKey;
+  char minValue[ZONE_PREFIX_SIZE];
+  char maxValue[ZONE_PREFIX_SIZE];
+} Zone;
+
+/**
+ * the records a scan is restricted to: the keys in [loKey, hiKey] and
+ * the values from loValue on, up to hiValue if hasHiValue.
+ */
+typedef struct {
+  int         loKey;
+  int         hiKey;
+  std::string loValue;
+  std::string hiValue;
+  bool        hasHiValue;
+} ScanBounds;
+
 /**
  * read/write a record to a file
+ *
+ * records are stored in PAX pages, which keep the keys and the values of
+ * their records apart. a page starts with # records in the page, the
+ * smallest key and the width of the keys, followed by the keys of all
+ * records as an array of 1, 2 or 4-byte differences from the smallest key,
+ * and by a directory of slots holding the offset of every value. the
+ * values are packed from the end of the page towards the directory, so a
+ * page holds as many records as their values leave room for. the slot
+ * number of a record never changes, so a RecordId stays valid.
+ *
+ * a value is kept as it is on its first appearances in the table. once
+ * it repeats, it is added to the dictionary of the table, in
+ * filename.dict, and later copies of the value only keep its code in the
+ * dictionary. the values are decoded one record at a time as they are
+ * read, and a dictionary page is read when a code in it is first met.
+ * the keys of a page can be read all at once without touching the values.
+ *
+ * pages written in the earlier formats of fixed 104-byte slots and of
+ * slotted records are still read. records are never appended to them.
  */
 class RecordFile {
  public:
 
-  // maximum length of the value field
-  static const int MAX_VALUE_LENGTH = 100;  
+  // maximum length of the value field. a longer value is truncated.
+  // a record with the longest value fills a page by itself.
+  static const int MAX_VALUE_LENGTH = PageFile::PAGE_SIZE - 4 * sizeof(int);
+
+  // maximum number of record slots per page, reached when the keys are
+  // close together and every value is empty or a short code.
+  // a record takes four bytes at least with its slot.
+  static const int RECORDS_PER_PAGE = (PageFile::PAGE_SIZE - 3 * sizeof(int)) / sizeof(int);
 
-  // number of record slots per page
-  static const int RECORDS_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int))/ (sizeof(int) + MAX_VALUE_LENGTH);  
-    // Note that we subtract sizeof(int) from PAGE_SIZE because the first
-    // four bytes in the page is used to store # records in the page.
+  // maximum number of pages written by a single write in appendBatch()
+  static const int APPEND_BATCH_PAGES = 64;
+
+  // number of pages summarized by one entry of the zone map
+  static const int ZONE_PAGES = 8;
 
   RecordFile();
   RecordFile(const std::string& filename, char mode);
+  ~RecordFile();
   
   /**
    * open a file in read or write mode.
    * when opened in 'w' mode, if the file does not exist, it is created.
+   * the zone map of the file is kept in filename.zm next to it, and the
+   * dictionary of its values in filename.dict.
    * @param filename[IN] the name of the file to open
    * @param mode[IN] 'r' for read, 'w' for write
    * @return error code. 0 if no error
@@ -79,6 +139,19 @@ class RecordFile {
    */
   RC read(const RecordId& rid, int& key, std::string& value) const;
 
+  /**
+   * read many records from the file.
+   * the records are read in the order of their record ids, so that every
+   * page is read only once and the pages are read in ascending order with
+   * read-ahead. the records are returned in the order of rids.
+   * @param rids[IN] the ids of the records to read
+   * @param keys[OUT] the record keys, in the order of rids
+   * @param values[OUT] the record values, in the order of rids
+   * @return error code. 0 if no error
+   */
+  RC readBatch(const std::vector<RecordId>& rids, std::vector<int>& keys,
+               std::vector<std::string>& values) const;
+
   /**
    * append a new record at the end of the file.
    * note that RecordFile does not have write() function.
@@ -91,14 +164,178 @@ class RecordFile {
   RC append(int key, const std::string& value, RecordId& rid);
 
   /**
-   * note the +1 part. The rid of the last record is endRid()-1.
+   * append many records at the end of the file.
+   * the records are packed into pages in memory and every page is
+   * written exactly once, up to APPEND_BATCH_PAGES pages per write.
+   * @param records[IN] the (key, value) pairs to append
+   * @param rids[OUT] the locations of the stored records, in input order
+   * @return error code. 0 if no error
+   */
+  RC appendBatch(const std::vector<std::pair<int, std::string> >& records,
+                 std::vector<RecordId>& rids);
+
+  /**
+   * note the +1 part. The rid of the last record is endRid()-1, or the
+   * last slot of the page before if endRid() is the first slot of a page.
    * @return (last record id + 1) of the RecordFile
    */
   const RecordId& endRid() const;
 
+  /**
+   * tell the operating system how the records will be accessed.
+   * @param pattern[IN] PageFile::ACCESS_SEQUENTIAL for a table scan,
+   *                    PageFile::ACCESS_RANDOM for index-driven lookups
+   * @return error code. 0 if no error
+   */
+  RC advise(int pattern) const;
+
+  /**
+   * check with the zone map whether the extent holding page pid may have
+   * a record within the bounds. an extent not in the zone map may.
+   * @param pid[IN] a page of the extent
+   * @param bounds[IN] the records looked for
+   * @return false if no record of the extent is within the bounds
+   */
+  bool mayMatch(PageId pid, const ScanBounds& bounds) const;
+
  private:
+  friend class RecordScan;
+
+  RecordFile(const RecordFile&);            // files are not copyable
+  RecordFile& operator=(const RecordFile&);
+
+  // read the n'th record of the page, looking up its value in the
+  // dictionary if the record keeps its code
+  RC readRecord(const char* page, int n, int& key, std::string& value) const;
+
+  // the code of the value in the dictionary if a record should keep it
+  // in place of the value. -1 if the record should keep the value
+  int encodeValue(const std::string& value);
+
+  // read the zone map into zones unless it has been read already
+  RC readZones() const;
+
+  // add the records in the page to the zone
+  RC addToZone(Zone& zone, const char* page) const;
+
+  // add the records of the pages [from, to) of the file to the zone map
+  // and write the changed zone map pages
+  RC updateZones(PageId from, PageId to, const char* pages);
+
   PageFile pf;     // the PageFile used to store the records
   RecordId erid;   // the last record id of the file + 1
+  ValueDictionary dict; // the values kept once for the whole file
+
+  mutable PageFile          zf;          // the zone map of the file
+  mutable std::vector<Zone> zones;       // the zone map, one zone per extent
+  mutable bool              zonesRead;   // true once zones has been read
+  mutable pthread_mutex_t   zoneMutex;   // guards reading the zone map
+};
+
+/**
+ * scan the records of a RecordFile in the order of their record ids.
+ * every page is pinned once and all of its records are returned from it,
+ * while the pages ahead of the scan are prefetched in the background.
+ */
+class RecordScan {
+ public:
+
+  // number of pages prefetched ahead of the scan at a time
+  static const int READ_AHEAD_PAGES = 32;
+
+  RecordScan();
+  ~RecordScan();
+
+  /**
+   * start scanning a RecordFile from its first record.
+   * @param rf[IN] the RecordFile to scan. it must stay open during the scan
+   * @return error code. 0 if no error
+   */
+  RC open(const RecordFile& rf);
+
+  /**
+   * start scanning a RecordFile from its first record, skipping the
+   * extents that the zone map shows to have no record within bounds.
+   * the records of the other extents are all returned.
+   * @param rf[IN] the RecordFile to scan. it must stay open during the scan
+   * @param bounds[IN] the records looked for
+   * @return error code. 0 if no error
+   */
+  RC open(const RecordFile& rf, const ScanBounds& bounds);
+
+  /**
+   * scan the pages [first, end) of a RecordFile alone, skipping the
+   * extents that the zone map shows to have no record within bounds.
+   * @param rf[IN] the RecordFile to scan. it must stay open during the scan
+   * @param bounds[IN] the records looked for
+   * @param first[IN] the first page to scan
+   * @param end[IN] the page after the last one to scan
+   * @return error code. 0 if no error
+   */
+  RC open(const RecordFile& rf, const ScanBounds& bounds, PageId first, PageId end);
+
+  /**
+   * read the next record and advance the scan.
+   * @param rid[OUT] the id of the record
+   * @param key[OUT] the record key
+   * @param value[OUT] the record value
+   * @return error code. 0 if no error. RC_END_OF_FILE if no record is left
+   */
+  RC next(RecordId& rid, int& key, std::string& value);
+
+  /**
+   * read the key of the next record and advance the scan, without
+   * decoding its value.
+   * @param rid[OUT] the id of the record
+   * @param key[OUT] the record key
+   * @return error code. 0 if no error. RC_END_OF_FILE if no record is left
+   */
+  RC next(RecordId& rid, int& key);
+
+  /**
+   * read the keys of the records left in the current page, or in the next
+   * page if none is left, and advance the scan past them. the values of
+   * these records can be read by readValue() until the next call.
+   * @param rid[OUT] the id of the first record
+   * @param keys[OUT] the keys of the records, in the order of their ids
+   * @return error code. 0 if no error. RC_END_OF_FILE if no record is left
+   */
+  RC nextKeys(RecordId& rid, std::vector<int>& keys);
+
+  /**
+   * read the value of a record whose key was read by the last nextKeys().
+   * @param sid[IN] the slot of the record in its page
+   * @param value[OUT] the record value
+   * @return error code. 0 if no error
+   */
+  RC readValue(int sid, std::string& value) const;
+
+  /**
+   * finish the scan and release the current page.
+   */
+  void close();
+
+ private:
+  RecordScan(const RecordScan&);            // scans are not copyable
+  RecordScan& operator=(const RecordScan&);
+
+  // pin the page pid as the current page and read ahead if necessary
+  RC loadPage(PageId pid);
+
+  // move rid past the extents without a record within bounds
+  void skipExtents();
+
+  // move rid to the next record, pinning its page
+  RC seekRecord();
+
+  const RecordFile* rf; // the RecordFile being scanned
+  const char* page;     // the pinned current page (NULL if none)
+  RecordId    rid;      // the id of the next record to return
+  int         count;    // # records in the current page
+  PageId      ahead;    // the first page that has not been prefetched yet
+  PageId      endPid;   // the page after the last one to scan
+  bool        bounded;  // true if the scan skips extents out of bounds
+  ScanBounds  bounds;   // the records looked for if bounded
 };
 
 #endif // RECORDFILE_H
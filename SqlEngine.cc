@@ -13,9 +13,17 @@
 #include <iostream>
 #include <fstream>
 #include <climits>
+#include <algorithm>
+#include <map>
+#include <unistd.h>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
 #include "BTreeIndex.h"
+#include "StringIndex.h"
+#include "HashIndex.h"
+#include "BloomFilter.h"
+#include "Predicate.h"
+#include "Executor.h"
 
 using namespace std;
 
@@ -23,7 +31,8 @@ using namespace std;
 extern FILE* sqlin;
 int sqlparse(void);
 
-static int cnt = 1;
+// # tuples read from a load file and appended to a table at a time
+static const unsigned LOAD_BATCH_SIZE = 4096;
 
 RC SqlEngine::run(FILE* commandline)
 {
@@ -72,64 +81,195 @@ RC processRange(vector<SelCond>& newCond, const SelCond& cond, long& lo, long& h
   return 0;
 }
 
-bool checkConditions(const vector<SelCond>& cond, RecordId& rid, int key, string& value) {
-  int diff;
+// narrow the values allowed by the EQ, GT, GE, LT and LE conditions on
+// value down to [lo, hi]. hasHi is false if there is no upper bound.
+// returns false if the conditions do not bound the values at all
+static bool valueRange(const vector<SelCond>& cond, string& lo, string& hi, bool& hasHi)
+{
+  bool bounded = false;
 
+  lo.clear();
+  hasHi = false;
   for (unsigned i = 0; i < cond.size(); i++) {
-	// compute the difference between the tuple value and the condition value
-	switch (cond[i].attr) {
-	case 1:
-	  diff = key - atoi(cond[i].value);
-	  break;
-	case 2:
-	  diff = strcmp(value.c_str(), cond[i].value);
-	  break;
-	}
+    if (cond[i].attr != 2 || cond[i].comp == SelCond::NE)
+      continue;
+    string v(cond[i].value);
+    if (cond[i].comp != SelCond::LT && cond[i].comp != SelCond::LE && v > lo)
+      lo = v;
+    if (cond[i].comp != SelCond::GT && cond[i].comp != SelCond::GE && (!hasHi || v < hi)) {
+      hi = v;
+      hasHi = true;
+    }
+    bounded = true;
+  }
+  return bounded;
+}
 
-	 // skip the tuple if any condition is not met
-	switch (cond[i].comp) {
-	case SelCond::EQ:
-	  if (diff != 0) return false;
-	case SelCond::NE:
-	  if (diff == 0) return false;
-	case SelCond::GT:
-	  if (diff <= 0) return false;
-	case SelCond::LT:
-	  if (diff >= 0) return false;
-	case SelCond::GE:
-	  if (diff < 0) return false;
-	case SelCond::LE:
-	  if (diff > 0) return false;
-	}
+// the Bloom filters of the tables, kept open so that the pages read once
+// stay in memory. a lookup they rule out then reads no page at all
+static map<string, BloomFilter*> filters;
+
+// the Bloom filter of the table, opened on first use. NULL if it has none
+static BloomFilter* filterOf(const string& table)
+{
+  map<string, BloomFilter*>::iterator it = filters.find(table);
+  if (it != filters.end())
+    return it->second;
+
+  BloomFilter* filter = new BloomFilter();
+  if (filter->open(table + ".blm", 'r') < 0) {
+    delete filter;
+    return NULL;
   }
-  return true;
+  filters[table] = filter;
+  return filter;
 }
 
-void printTuple(int attr, int key, string& value) {
-  switch (attr) {
-  case 1:  // SELECT key
-    fprintf(stdout, "%d\n", key);
-    break;
-  case 2:  // SELECT value
-    fprintf(stdout, "%s\n", value.c_str());
-    break;
-  case 3:  // SELECT *
-    fprintf(stdout, "%d '%s'\n", key, value.c_str());
-    break;
+// drop the Bloom filter of the table kept open
+static void forgetFilter(const string& table)
+{
+  map<string, BloomFilter*>::iterator it = filters.find(table);
+  if (it != filters.end()) {
+    it->second->close();
+    delete it->second;
+    filters.erase(it);
+  }
+}
+
+// true if the Bloom filter of the table tells that an equality condition
+// on key or value cannot be met
+static bool filterMisses(const string& table, const vector<SelCond>& cond)
+{
+  BloomFilter* filter;
+  bool         miss = false;
+  unsigned     i;
+
+  // the filter is only read for an equality condition
+  for (i = 0; i < cond.size() && cond[i].comp != SelCond::EQ; i++);
+  if (i == cond.size() || (filter = filterOf(table)) == NULL)
+    return false;
+
+  for (; i < cond.size() && !miss; i++) {
+    if (cond[i].comp != SelCond::EQ) continue;
+    if (cond[i].attr == 1) {
+      long key = atol(cond[i].value);
+      if (key >= INT_MIN && key <= INT_MAX)
+        miss = !filter->mayContain(BloomFilter::hashKey((int) key));
+    }
+    else if (cond[i].attr == 2) {
+      miss = !filter->mayContain(BloomFilter::hashValue(cond[i].value));
+    }
+  }
+  return miss;
+}
+
+// the hashes of a tuple's key and value as entries of the Bloom filter.
+// the value is hashed as it is stored in the table
+static void filterHashes(int key, const string& value, vector<unsigned>& hashes)
+{
+  hashes.push_back(BloomFilter::hashKey(key));
+  if ((int) value.size() > RecordFile::MAX_VALUE_LENGTH)
+    hashes.push_back(BloomFilter::hashValue(value.substr(0, RecordFile::MAX_VALUE_LENGTH)));
+  else
+    hashes.push_back(BloomFilter::hashValue(value));
+}
+
+// add the tuples just loaded to the Bloom filter of the table. once the
+// table outgrows the filter, the filter is sized for twice the table and
+// filled again from all of its tuples.
+static RC updateFilter(BloomFilter& filter, const RecordFile& rf, const vector<unsigned>& hashes, bool wasEmpty)
+{
+  RecordScan scan;
+  RecordId   rid;
+  int        key;
+  string     value;
+  vector<unsigned> all;
+  RC         rc;
+
+  if (wasEmpty)
+    filter.resize(2 * hashes.size());
+  if (filter.capacity() >= (long) filter.entries() + (long) hashes.size()) {
+    for (unsigned i = 0; i < hashes.size(); i++)
+      filter.add(hashes[i]);
+    return 0;
+  }
+
+  // the tuples loaded before are not in hashes. read them all again.
+  rf.advise(PageFile::ACCESS_SEQUENTIAL);
+  scan.open(rf);
+  while ((rc = scan.next(rid, key, value)) == 0)
+    filterHashes(key, value, all);
+  scan.close();
+  if (rc != RC_END_OF_FILE)
+    return rc;
+
+  filter.resize(2 * all.size());
+  for (unsigned i = 0; i < all.size(); i++)
+    filter.add(all[i]);
+  return 0;
+}
+
+// true if the file exists
+static bool fileExists(const string& filename)
+{
+  return access(filename.c_str(), F_OK) == 0;
+}
+
+// add the tuples already in the table to the indexes being bulk loaded
+// (NULL for the others)
+static RC indexTable(const RecordFile& rf, BTreeIndex* tree, StringIndex* valueTree, HashIndex* hashIndex)
+{
+  RecordScan scan;
+  RecordId   rid;
+  int        key;
+  string     value;
+  RC         rc;
+
+  // the values are decoded only if an index keeps them
+  bool needValue = (valueTree != NULL || (tree != NULL && tree->isCovering()));
+
+  rf.advise(PageFile::ACCESS_SEQUENTIAL);
+  if ((rc = scan.open(rf)) < 0)
+    return rc;
+  while ((rc = needValue ? scan.next(rid, key, value) : scan.next(rid, key)) == 0) {
+    if (tree != NULL && (rc = tree->bulkInsert(key, rid, value)) < 0)
+      break;
+    if (valueTree != NULL && (rc = valueTree->bulkInsert(value, rid)) < 0)
+      break;
+    if (hashIndex != NULL && (rc = hashIndex->bulkInsert(key, rid)) < 0)
+      break;
   }
+  scan.close();
+  return (rc == RC_END_OF_FILE) ? 0 : rc;
 }
 
 RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 {
   RecordFile  rf;   // RecordFile containing the table
-  RecordId    rid;  // record cursor for table scanning
   BTreeIndex  tree;
-  IndexCursor cur;
-  
+  StringIndex valueTree; // index on the value column
+  HashIndex   hashIndex; // hash index on the key column
+  Operator*   plan = NULL; // the operators answering the SELECT
+  TupleBatch  batch;
+  const char* source = "table"; // what the plan reads the tuples from
+  bool        counted = false;  // true if the plan counts the tuples itself
+
   RC     rc;
-  int    key;     
-  string value;
-  int    count = 0;
+  string loValue, hiValue; // the range of values for the value index
+  bool   hasHiValue;
+
+  Predicate pred(cond);    // the conditions compiled for checking tuples
+  vector<SelCond> newCond; // the conditions left after the key range
+  int    NEonKey = 0; // number of NE condition(s) on key
+  bool   validRange = true; // false if no key can meet the conditions
+  long   lo = LONG_MIN, hi = LONG_MAX; // using long to avoid overflow
+
+  // a key or value missing from the Bloom filter is not in the table.
+  // the filter is checked first, so that such a lookup reads no page
+  if (filterMisses(table, cond)) {
+    if (attr == 4) fprintf(stdout, "0\n");
+    return 0;
+  }
 
   // open the table file
   if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
@@ -137,129 +277,156 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
     return rc;
   }
 
-  // open the index file  
-  if (tree.open(table + ".idx", 'r') == 0) {
-    vector<SelCond> newCond;
-    SelCond temp;
-    temp.attr = 1;
-	int NEonKey = 0; // number of NE condition(s) on key
-    long lo = LONG_MIN, hi = LONG_MAX; // using long to avoid overflow
-    for (unsigned i = 0; i < cond.size(); i++) {
-      switch (cond[i].attr) {
-      case 1:
-        rc = processRange(newCond, cond[i], lo, hi);
-        if (rc == -1)
-          return 0; // range is invalid
-		if (rc == -2)
-		  NEonKey++;
-        break;
-      case 2:
-        newCond.push_back(cond[i]);
-        break;
-      }
+  // narrow the keys down to [lo, hi] by the conditions on key
+  for (unsigned i = 0; i < cond.size() && validRange; i++) {
+    switch (cond[i].attr) {
+    case 1:
+      rc = processRange(newCond, cond[i], lo, hi);
+      if (rc == -1)
+        validRange = false;
+      if (rc == -2)
+        NEonKey++;
+      break;
+    case 2:
+      newCond.push_back(cond[i]);
+      break;
     }
-    
-    if (lo == LONG_MIN && hi == LONG_MAX)
-      goto scan_table; // No range or point query on key
-    
-    int loKey = (int) lo, hiKey = (int) hi;
-      
-    rc = tree.locate(loKey, cur);
-    if (rc != 0 && rc != RC_NO_SUCH_RECORD) {
-      fprintf(stderr, "Error: while reading a tuple from index %s\n", table.c_str());
-      goto exit_select;
-    }
-    
-    if (rc == 0 && newCond.empty() && attr == 1) {
-      while (cur.pid > 0 && (rc = tree.readForward(cur, key, rid)) == 0) {
-        if (key > hiKey) break;
-        count++;
-        printTuple(attr, key, value);
-      }
-    }
-    else if (rc == 0 && NEonKey == newCond.size() && attr == 1) {
-      while (cur.pid > 0 && (rc = tree.readForward(cur, key, rid)) == 0) {
-        if (key > hiKey) break;
-        
-		for (unsigned i = 0; i < newCond.size(); i++)
-		  if (key == atoi(newCond[i].value)) continue;
-
-        count++;
-        printTuple(attr, key, value);
-      }
+  }
+
+  // no tuple is read if no key an int can hold is in range
+  if (!validRange || lo > INT_MAX || hi < INT_MIN) {
+    if (attr == 4) fprintf(stdout, "0\n");
+    rf.close();
+    return 0;
+  }
+
+  // only NE conditions on key are left if every condition is on key
+  bool keyConds = (NEonKey == (int) newCond.size());
+
+  // the values are read only if they are printed or compared
+  bool needValue = (attr == 2 || attr == 3 || pred.hasValueConditions());
+
+  // the range cannot go beyond the keys an int can hold
+  int loKey = (int) max(lo, (long) INT_MIN);
+  int hiKey = (int) min(hi, (long) INT_MAX);
+
+  // a point query on key reads a single bucket of the hash index if
+  // the table has one
+  if (lo == hi && hashIndex.open(table + ".hdx", 'r') == 0) {
+    source = "index";
+    plan = new HashLookup(hashIndex, rf, loKey, needValue);
+    if (!newCond.empty())
+      plan = new Filter(plan, pred);
+  }
+  // No range or point query on key. SELECT key and COUNT(*) with
+  // conditions on key alone still read the index, which holds every key
+  // in far fewer pages than the table
+  else if (tree.open(table + ".idx", 'r') == 0 &&
+           (lo != LONG_MIN || hi != LONG_MAX || ((attr == 1 || attr == 4) && keyConds))) {
+    source = "index";
+    if (attr == 4 && keyConds) {
+      // COUNT(*) is answered from the entry counts kept in the index
+      vector<int> notEqual;
+      for (unsigned i = 0; i < newCond.size(); i++)
+        notEqual.push_back(atoi(newCond[i].value));
+      plan = new IndexCount(tree, loKey, hiKey, notEqual);
+      counted = true;
     }
-    else if (rc == 0) {
-      while (cur.pid > 0 && (rc = tree.readForward(cur, key, rid)) == 0) {        
-        if (key > hiKey) break;
-        
-        if ((rc = rf.read(rid, key, value)) < 0) {
-          fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
-          goto exit_select;
-        }
-      
-        if (checkConditions(newCond, rid, key, value)) {
-          count++;
-          printTuple(attr, key, value);          
-        }
-      }
-	}
-	
-	if (rc < 0 && rc != RC_NO_SUCH_RECORD) {
-      fprintf(stderr, "Error: while reading a tuple from index %s\n", table.c_str());
-      goto exit_select;
+    else {
+      // SELECT key only needs the keys in the index unless a value
+      // condition remains
+      plan = new IndexScan(tree, rf, loKey, hiKey, needValue);
+      if (!newCond.empty())
+        plan = new Filter(plan, pred);
     }
   }
-  else {
-    scan_table:
-    // scan the table file from the beginning
-    rid.pid = rid.sid = 0;
-    while (rid < rf.endRid()) {
-      // read the tuple
-      if ((rc = rf.read(rid, key, value)) < 0) {
-        fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
-        goto exit_select;
-      }
-
-      // check the conditions on the tuple
-      if (!checkConditions(cond, rid, key, value))
-		goto next_tuple;
+  // a point or range query on value reads the value index if there is one
+  else if (valueRange(cond, loValue, hiValue, hasHiValue) &&
+           valueTree.open(table + ".vdx", 'r') == 0) {
+    // SELECT value and COUNT(*) with conditions on value alone read the
+    // index only
+    bool valueOnly = (attr == 2 || attr == 4) && !pred.hasKeyConditions();
 
-      // the condition is met for the tuple. 
-      // increase matching tuple counter
-      count++;
+    source = "index";
+    plan = new ValueIndexScan(valueTree, rf, loValue, hasHiValue ? &hiValue : NULL, valueOnly);
+    plan = new Filter(plan, pred);
+  }
+  else {
+    // scan the table file from the beginning, skipping the extents
+    // whose zone map rules out the key and value ranges
+    ScanBounds bounds;
+    bounds.loKey = loKey;
+    bounds.hiKey = hiKey;
+    bounds.loValue = loValue;
+    bounds.hiValue = hiValue;
+    bounds.hasHiValue = hasHiValue;
 
-      // print the tuple 
-      printTuple(attr, key, value);
+    // a table of more than one morsel is scanned by a thread per
+    // processor, each of them checking the conditions and counting on
+    // its own
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int  morselCount = rf.endRid().pid / ParallelScan::MORSEL_PAGES + 1;
+    if (cpus > 1 && morselCount > 1) {
+      plan = new ParallelScan(rf, bounds, pred, needValue, attr == 4, (int) min(cpus, (long) morselCount));
+      counted = (attr == 4);
+    }
+    else {
+      // the conditions on key are checked in the scan, so that the values
+      // are decoded only for the tuples whose keys meet them
+      vector<SelCond> keyCond, valueCond;
+      for (unsigned i = 0; i < cond.size(); i++)
+        (cond[i].attr == 1 ? keyCond : valueCond).push_back(cond[i]);
 
-      // move to the next tuple
-      next_tuple:
-      ++rid;
+      plan = new TableScan(rf, bounds, Predicate(keyCond), needValue);
+      if (!valueCond.empty())
+        plan = new Filter(plan, Predicate(valueCond));
     }
   }
 
-  // print matching tuple count if "select count(*)"
-  if (attr == 4) {
-    fprintf(stdout, "%d\n", count);
+  // print the matching tuples, or their count if "select count(*)"
+  if (attr == 4 && !counted)
+    plan = new Count(plan);
+  plan = new Project(plan, attr);
+
+  if ((rc = plan->open()) == 0) {
+    while ((rc = plan->next(batch)) == 0)
+      ;
   }
-  rc = 0;
+  if (rc == RC_END_OF_FILE)
+    rc = 0;
+  else
+    fprintf(stderr, "Error: while reading a tuple from %s %s\n", source, table.c_str());
 
-  // close the table file and return
-  exit_select:
+  // close the table and index files and return
+  delete plan;
+  tree.close();
+  valueTree.close();
+  hashIndex.close();
   rf.close();
   return rc;
 }
 
-RC SqlEngine::load(const string& table, const string& loadfile, bool index)
+RC SqlEngine::load(const string& table, const string& loadfile, bool index, bool covering, bool valueIndex, bool hashed)
 {
   /* your code here */
   RecordFile rf;   // RecordFile containing the table
   BTreeIndex tree;
+  StringIndex valueTree;
+  HashIndex  hashIndex;
+  BloomFilter* filter = NULL; // Bloom filter of the keys and values
   
   RC       rc;
+  RC       parseRc = 0;
+  bool     bulk = false; // true if the index is built bottom-up
+  bool     valueBulk = false; // true if the value index is built bottom-up
+  bool     hashBulk = false; // true if the hash index is built at once
   int      key;     
   string   value;
   string   line;
-  RecordId rid;
+  vector<pair<int, string> > tuples; // tuples read from the load file
+  vector<RecordId>           rids;   // where the tuples were stored
+  vector<unsigned>           hashes; // the filter entries of the loaded tuples
+  bool     wasEmpty = false; // true if the table had no tuple before
   
   // open the loadfile
   ifstream fileToLoad (loadfile.c_str());
@@ -274,37 +441,155 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
     fprintf(stderr, "Error: opening %s\n", tableName.c_str());
     goto exit_load;
   }
+  wasEmpty = (rf.endRid().pid == 0 && rf.endRid().sid == 0);
+
+  // every table keeps a Bloom filter for equality lookups. the filter
+  // kept open for queries is replaced by the one loaded here
+  forgetFilter(table);
+  filter = new BloomFilter();
+  if ((rc = filter->open(table + ".blm", 'w')) < 0) {
+    fprintf(stderr, "Error: opening %s\n", (table + ".blm").c_str());
+    goto exit_load;
+  }
   
+  // once a table has an index, every load keeps it up to date
+  index = index || fileExists(table + ".idx");
+  valueIndex = valueIndex || fileExists(table + ".vdx");
+  hashed = hashed || fileExists(table + ".hdx");
+
   if (index) {
     string indexName = table + ".idx";
-    if ((rc = tree.open(indexName, 'w')) < 0) {
+    if ((rc = tree.open(indexName, 'w', covering)) < 0) {
       fprintf(stderr, "Error: opening %s\n", indexName.c_str());
       goto exit_load;
     }    
+
+    // a new index is built bottom-up after all tuples are read.
+    // an existing index is extended one tuple at a time.
+    bulk = (tree.beginBulkLoad() == 0);
   }
-  
-  while (getline(fileToLoad, line)) {
-    if ((rc = parseLoadLine(line, key, value)) < 0) {
-      fprintf(stderr, "Error: while reading a line from %s\n", loadfile.c_str());
+
+  if (valueIndex) {
+    string indexName = table + ".vdx";
+    if ((rc = valueTree.open(indexName, 'w')) < 0) {
+      fprintf(stderr, "Error: opening %s\n", indexName.c_str());
+      goto exit_load;
+    }
+    valueBulk = (valueTree.beginBulkLoad() == 0);
+  }
+
+  if (hashed) {
+    string indexName = table + ".hdx";
+    if ((rc = hashIndex.open(indexName, 'w')) < 0) {
+      fprintf(stderr, "Error: opening %s\n", indexName.c_str());
       goto exit_load;
     }
+    hashBulk = (hashIndex.beginBulkLoad() == 0);
+  }
+
+  // a new index on a table with tuples starts with those tuples
+  if (!wasEmpty && (bulk || valueBulk || hashBulk) &&
+      (rc = indexTable(rf, bulk ? &tree : NULL, valueBulk ? &valueTree : NULL, hashBulk ? &hashIndex : NULL)) < 0) {
+    fprintf(stderr, "Error: while building the indexes of %s\n", table.c_str());
+    goto exit_load;
+  }
+  
+  // load the tuples LOAD_BATCH_SIZE at a time so that every table page
+  // is written only once
+  tuples.reserve(LOAD_BATCH_SIZE);
+  do {
+    tuples.clear();
+    while (tuples.size() < LOAD_BATCH_SIZE && getline(fileToLoad, line)) {
+      if ((parseRc = parseLoadLine(line, key, value)) < 0) break;
+      tuples.push_back(make_pair(key, value));
+    }
     
-    if ((rc = rf.append(key, value, rid)) < 0) {
+    if ((rc = rf.appendBatch(tuples, rids)) < 0) {
       fprintf(stderr, "Error: while inserting a tuple into table %s\n", table.c_str());
       goto exit_load;
     }
+    for (unsigned i = 0; i < tuples.size(); i++)
+      filterHashes(tuples[i].first, tuples[i].second, hashes);
     
     if (index) {
-      if ((rc = tree.insert(key, rid)) < 0) {
-        fprintf(stderr, "Error: while inserting into index %s\n", table.c_str());
-        goto exit_load;
+      for (unsigned i = 0; i < tuples.size(); i++) {
+        rc = bulk ? tree.bulkInsert(tuples[i].first, rids[i], tuples[i].second)
+                  : tree.insert(tuples[i].first, rids[i], tuples[i].second);
+        if (rc < 0) {
+          fprintf(stderr, "Error: while inserting into index %s\n", table.c_str());
+          goto exit_load;
+        }
+      }
+    }
+
+    if (valueIndex) {
+      for (unsigned i = 0; i < tuples.size(); i++) {
+        rc = valueBulk ? valueTree.bulkInsert(tuples[i].second, rids[i])
+                       : valueTree.insert(tuples[i].second, rids[i]);
+        if (rc < 0) {
+          fprintf(stderr, "Error: while inserting into index %s\n", table.c_str());
+          goto exit_load;
+        }
+      }
+    }
+
+    if (hashed) {
+      for (unsigned i = 0; i < tuples.size(); i++) {
+        rc = hashBulk ? hashIndex.bulkInsert(tuples[i].first, rids[i])
+                      : hashIndex.insert(tuples[i].first, rids[i]);
+        if (rc < 0) {
+          fprintf(stderr, "Error: while inserting into index %s\n", table.c_str());
+          goto exit_load;
+        }
       }
     }
-  }  
+
+    // the tuples before a malformed line have been loaded. stop here.
+    if (parseRc < 0) {
+      fprintf(stderr, "Error: while reading a line from %s\n", loadfile.c_str());
+      rc = parseRc;
+      goto exit_load;
+    }
+  } while (tuples.size() == LOAD_BATCH_SIZE);
+
+  if (bulk && (rc = tree.endBulkLoad()) < 0) {
+    fprintf(stderr, "Error: while building index %s\n", table.c_str());
+    goto exit_load;
+  }
+  if (valueBulk && (rc = valueTree.endBulkLoad()) < 0) {
+    fprintf(stderr, "Error: while building index %s\n", table.c_str());
+    goto exit_load;
+  }
+  if (hashBulk && (rc = hashIndex.endBulkLoad()) < 0) {
+    fprintf(stderr, "Error: while building index %s\n", table.c_str());
+    goto exit_load;
+  }
   rc = 0;
   
   exit_load:
+  // index the tuples loaded before an error
+  if (bulk && rc < 0) tree.endBulkLoad();
+  if (valueBulk && rc < 0) valueTree.endBulkLoad();
+  if (hashBulk && rc < 0) hashIndex.endBulkLoad();
+  if (filter != NULL && (rf.endRid().pid > 0 || rf.endRid().sid > 0)) {
+    RC filterRc = updateFilter(*filter, rf, hashes, wasEmpty);
+    if (filterRc < 0 && rc == 0) {
+      fprintf(stderr, "Error: while building the filter of %s\n", table.c_str());
+      rc = filterRc;
+    }
+  }
+  // the new filter stays in memory for the queries that follow
+  if (filter != NULL) {
+    if (filter->closeFile() == 0 && rc == 0)
+      filters[table] = filter;
+    else {
+      filter->close();
+      delete filter;
+    }
+  }
   tree.close();
+  valueTree.close();
+  hashIndex.close();
   rf.close();
   fileToLoad.close();
   return rc;
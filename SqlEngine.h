@@ -55,9 +55,15 @@ class SqlEngine {
    * @param table[IN] the table name in the LOAD command
    * @param loadfile[IN] the file name of the load file
    * @param index[IN] true if "WITH INDEX" option was specified
+   * @param covering[IN] true if "WITH COVERING INDEX" option was specified.
+   *                     a covering index keeps the values in its leaves too
+   * @param valueIndex[IN] true if "WITH INDEX ON value" option was specified.
+   *                       the index on the value column is kept in table.vdx
+   * @param hashed[IN] true if "WITH HASH INDEX" option was specified. a hash
+   *                   index on key for point queries is kept in table.hdx
    * @return error code. 0 if no error
    */
-  static RC load(const std::string& table, const std::string& loadfile, bool index);
+  static RC load(const std::string& table, const std::string& loadfile, bool index, bool covering = false, bool valueIndex = false, bool hashed = false);
 
   /**
    * parse a line from the load file into the (key, value) pair.
@@ -37,7 +37,7 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
   std::vector<SelCond>* conds;
 }
 
-%token SELECT FROM WHERE LOAD WITH INDEX QUIT COUNT AND OR 
+%token SELECT FROM WHERE LOAD WITH INDEX COVERING ON HASH QUIT COUNT AND OR 
 %token COMMA STAR LF
 %token <string> INTEGER STRING ID
 %token EQUAL NEQUAL LESS LESSEQUAL GREATER GREATEREQUAL 
@@ -76,6 +76,21 @@ load_command:
 	  free($2);
 	  free($4);
 	}
+	| LOAD table FROM STRING WITH COVERING INDEX LF { 
+	  SqlEngine::load(std::string($2), std::string($4), true, true); 
+	  free($2);
+	  free($4);
+	}
+	| LOAD table FROM STRING WITH HASH INDEX LF { 
+	  SqlEngine::load(std::string($2), std::string($4), true, false, false, true); 
+	  free($2);
+	  free($4);
+	}
+	| LOAD table FROM STRING WITH INDEX ON attribute LF { 
+	  SqlEngine::load(std::string($2), std::string($4), $8 == 1, false, $8 == 2); 
+	  free($2);
+	  free($4);
+	}
 	;
 
 select_command:
@@ -0,0 +1,519 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#include "StringIndex.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+// identifies page 0 of a value index
+static const int STRING_INDEX_MAGIC = 0x58445653; // "SVDX"
+
+// the fraction of every node filled by bulk loading
+static const double BULK_FILL_FACTOR = 0.9;
+
+// # bytes of the header of a node: [count][next or leftmost pid]
+static const int NODE_HEADER_SIZE = sizeof(int) + sizeof(PageId);
+
+/*
+ * a node read from its page. the i-th key of a leaf belongs to ptrs[i],
+ * and link is the next leaf. the i-th key of a nonleaf node separates
+ * the child before it from the child ptrs[i].pid after it, and link is
+ * the leftmost child.
+ */
+typedef struct {
+  vector<string>   keys;
+  vector<RecordId> ptrs;
+  PageId           link;
+} StrNode;
+
+// # bytes an entry with the key takes in a node
+static int entrySize(const string& key, bool leaf)
+{
+  return 1 + key.size() + (leaf ? sizeof(RecordId) : sizeof(PageId));
+}
+
+// # bytes of the first n entries of the node, with the node header
+static int nodeSize(const StrNode& node, unsigned n, bool leaf)
+{
+  int size = NODE_HEADER_SIZE;
+  for (unsigned i = 0; i < n; i++)
+    size += entrySize(node.keys[i], leaf);
+  return size;
+}
+
+static RC readNode(const PageFile& pf, PageId pid, bool leaf, StrNode& node)
+{
+  RC   rc;
+  char page[PageFile::PAGE_SIZE];
+  int  count;
+
+  if ((rc = pf.read(pid, page)) < 0)
+    return rc;
+
+  memcpy(&count, page, sizeof(int));
+  memcpy(&node.link, page + sizeof(int), sizeof(PageId));
+  node.keys.resize(count);
+  node.ptrs.resize(count);
+
+  const char* p = page + NODE_HEADER_SIZE;
+  for (int i = 0; i < count; i++) {
+    int length = (unsigned char) *p;
+    if (p + entrySize(string(), leaf) + length > page + PageFile::PAGE_SIZE)
+      return RC_INVALID_FILE_FORMAT;
+    node.keys[i].assign(p + 1, length);
+    p += 1 + length;
+    if (leaf) {
+      memcpy(&node.ptrs[i], p, sizeof(RecordId));
+      p += sizeof(RecordId);
+    }
+    else {
+      memcpy(&node.ptrs[i].pid, p, sizeof(PageId));
+      node.ptrs[i].sid = 0;
+      p += sizeof(PageId);
+    }
+  }
+  return 0;
+}
+
+// write the entries [from, to) of the node to page pid
+static RC writeNode(PageFile& pf, PageId pid, bool leaf, const StrNode& node, unsigned from, unsigned to, PageId link)
+{
+  char page[PageFile::PAGE_SIZE];
+  int  count = to - from;
+
+  memset(page, 0, PageFile::PAGE_SIZE);
+  memcpy(page, &count, sizeof(int));
+  memcpy(page + sizeof(int), &link, sizeof(PageId));
+
+  char* p = page + NODE_HEADER_SIZE;
+  for (unsigned i = from; i < to; i++) {
+    *p = (char) node.keys[i].size();
+    memcpy(p + 1, node.keys[i].data(), node.keys[i].size());
+    p += 1 + node.keys[i].size();
+    if (leaf) {
+      memcpy(p, &node.ptrs[i], sizeof(RecordId));
+      p += sizeof(RecordId);
+    }
+    else {
+      memcpy(p, &node.ptrs[i].pid, sizeof(PageId));
+      p += sizeof(PageId);
+    }
+  }
+  return pf.write(pid, page);
+}
+
+/*
+ * the shortest prefix of right that is larger than left, which separates
+ * a node ending with left from the node after it starting with right.
+ * if the two are the same value, the value itself.
+ */
+static string separator(const string& left, const string& right)
+{
+  unsigned common = 0;
+  while (common < left.size() && common < right.size() && left[common] == right[common])
+    common++;
+  return right.substr(0, min<unsigned>(common + 1, right.size()));
+}
+
+// the child of a nonleaf node to follow for searchKey. going left of a
+// key equal to searchKey reaches the leftmost entry with the key
+static PageId childFor(const StrNode& node, const string& searchKey, unsigned& pos)
+{
+  pos = lower_bound(node.keys.begin(), node.keys.end(), searchKey) - node.keys.begin();
+  return (pos == 0) ? node.link : node.ptrs[pos - 1].pid;
+}
+
+StringIndex::StringIndex()
+: fileMode('r'), rootPid(-1), treeHeight(0), bulkLoading(false),
+  bulkEntries(SORT_BUFFER_ENTRIES)
+{
+}
+
+RC StringIndex::open(const string& indexname, char mode)
+{
+  RC rc;
+  if ((rc = pf.open(indexname, mode)) < 0)
+    return rc;
+  fileMode = mode;
+
+  if (pf.endPid() == 0) {
+    if (mode == 'r' || mode == 'R') { // nothing to read from an empty index
+      pf.close();
+      return RC_INVALID_FILE_FORMAT;
+    }
+    rootPid = -1;
+    treeHeight = 0;
+    if ((rc = writeMetadata()) < 0)
+      return rc;
+  }
+  else {
+    char buffer[PageFile::PAGE_SIZE];
+    int  magic;
+
+    if ((rc = pf.read(0, buffer)) < 0)
+      return rc;
+    memcpy(&rootPid, buffer, sizeof(PageId));
+    memcpy(&treeHeight, buffer + sizeof(PageId), sizeof(int));
+    memcpy(&magic, buffer + sizeof(PageId) + sizeof(int), sizeof(int));
+    if (magic != STRING_INDEX_MAGIC) {
+      pf.close();
+      return RC_INVALID_FILE_FORMAT;
+    }
+  }
+
+  // lookups jump around the index file
+  pf.advise(PageFile::ACCESS_RANDOM);
+
+  return 0;
+}
+
+RC StringIndex::close()
+{
+  bulkLoading = false;
+  bulkEntries.clear();
+
+  // the metadata can only have changed under 'w' mode
+  if (fileMode == 'r' || fileMode == 'R')
+    return pf.close();
+
+  RC rc;
+  if ((rc = writeMetadata()) < 0)
+    return rc;
+  return pf.close();
+}
+
+RC StringIndex::writeMetadata()
+{
+  char buffer[PageFile::PAGE_SIZE];
+  int  magic = STRING_INDEX_MAGIC;
+
+  memset(buffer, 0, PageFile::PAGE_SIZE);
+  memcpy(buffer, &rootPid, sizeof(PageId));
+  memcpy(buffer + sizeof(PageId), &treeHeight, sizeof(int));
+  memcpy(buffer + sizeof(PageId) + sizeof(int), &magic, sizeof(int));
+
+  return pf.write(0, buffer);
+}
+
+RC StringIndex::insert(const string& value, const RecordId& rid)
+{
+  RC     rc;
+  string key = keyOf(value);
+  string keyUp;
+  PageId newPid;
+
+  // the first entry makes a single leaf as the root
+  if (rootPid < 0) {
+    StrNode leaf;
+    leaf.keys.push_back(key);
+    leaf.ptrs.push_back(rid);
+    rootPid = max(pf.endPid(), 1);
+    treeHeight = 1;
+    if ((rc = writeNode(pf, rootPid, true, leaf, 0, 1, -1)) < 0)
+      return rc;
+    return writeMetadata();
+  }
+
+  if ((rc = insertHelper(key, rid, rootPid, 1, keyUp, newPid)) < 0)
+    return rc;
+
+  // the root split. a new root goes on top of the two halves
+  if (newPid > 0) {
+    StrNode  root;
+    RecordId child = { newPid, 0 };
+    root.keys.push_back(keyUp);
+    root.ptrs.push_back(child);
+    PageId pid = pf.endPid();
+    if ((rc = writeNode(pf, pid, false, root, 0, 1, rootPid)) < 0)
+      return rc;
+    rootPid = pid;
+    treeHeight++;
+    return writeMetadata();
+  }
+  return 0;
+}
+
+RC StringIndex::insertHelper(const string& key, const RecordId& rid, PageId pid, int level, string& keyUp, PageId& newPid)
+{
+  RC       rc;
+  StrNode  node;
+  unsigned pos;
+  bool     leaf = (level == treeHeight);
+
+  newPid = -1;
+  if ((rc = readNode(pf, pid, leaf, node)) < 0)
+    return rc;
+
+  if (leaf) {
+    // an entry goes after the entries with the same key
+    pos = upper_bound(node.keys.begin(), node.keys.end(), key) - node.keys.begin();
+    node.keys.insert(node.keys.begin() + pos, key);
+    node.ptrs.insert(node.ptrs.begin() + pos, rid);
+  }
+  else {
+    string   childKey;
+    PageId   childPid;
+    RecordId child;
+
+    if ((rc = insertHelper(key, rid, childFor(node, key, pos), level + 1, childKey, childPid)) < 0)
+      return rc;
+    if (childPid < 0)
+      return 0;
+
+    // the child split. its new sibling follows it in this node
+    child.pid = childPid;
+    child.sid = 0;
+    node.keys.insert(node.keys.begin() + pos, childKey);
+    node.ptrs.insert(node.ptrs.begin() + pos, child);
+  }
+
+  unsigned count = node.keys.size();
+  int      size = nodeSize(node, count, leaf);
+  if (size <= PageFile::PAGE_SIZE)
+    return writeNode(pf, pid, leaf, node, 0, count, node.link);
+
+  // split the node in two halves of about the same number of bytes
+  unsigned half = 1;
+  while (half < count - 2 && nodeSize(node, half, leaf) < size / 2)
+    half++;
+
+  newPid = pf.endPid();
+  if (leaf) {
+    keyUp = separator(node.keys[half - 1], node.keys[half]);
+    if ((rc = writeNode(pf, newPid, true, node, half, count, node.link)) < 0)
+      return rc;
+    return writeNode(pf, pid, true, node, 0, half, newPid);
+  }
+
+  // the middle key of a nonleaf node moves up and its child becomes the
+  // leftmost child of the new sibling
+  keyUp = node.keys[half];
+  if ((rc = writeNode(pf, newPid, false, node, half + 1, count, node.ptrs[half].pid)) < 0)
+    return rc;
+  return writeNode(pf, pid, false, node, 0, half, node.link);
+}
+
+RC StringIndex::findLeaf(const string& searchKey, PageId& pid) const
+{
+  RC       rc;
+  StrNode  node;
+  unsigned pos;
+
+  if (rootPid < 0)
+    return RC_END_OF_TREE;
+
+  pid = rootPid;
+  for (int level = 1; level < treeHeight; level++) {
+    if ((rc = readNode(pf, pid, false, node)) < 0)
+      return rc;
+    pid = childFor(node, searchKey, pos);
+  }
+  return 0;
+}
+
+bool StringIndex::BulkEntry::operator< (const BulkEntry& e) const
+{
+  int c = memcmp(key, e.key, min(length, e.length));
+  if (c != 0) return c < 0;
+  if (length != e.length) return length < e.length;
+  return rid < e.rid;
+}
+
+RC StringIndex::beginBulkLoad()
+{
+  if (rootPid >= 0)
+    return RC_INVALID_FILE_FORMAT;
+  bulkEntries.clear();
+  bulkLoading = true;
+  return 0;
+}
+
+RC StringIndex::bulkInsert(const string& value, const RecordId& rid)
+{
+  BulkEntry e;
+
+  if (!bulkLoading)
+    return insert(value, rid);
+
+  e.rid = rid;
+  e.length = (unsigned char) min<size_t>(value.size(), MAX_KEY_LENGTH);
+  memcpy(e.key, value.data(), e.length);
+  memset(e.key + e.length, 0, MAX_KEY_LENGTH - e.length);
+  return bulkEntries.add(e);
+}
+
+/*
+ * a node of the level being built by endBulkLoad(), with the first and
+ * the last key under it.
+ */
+typedef struct {
+  PageId pid;
+  string first;
+  string last;
+} BuiltNode;
+
+RC StringIndex::endBulkLoad()
+{
+  RC                rc;
+  StrNode           node;
+  vector<BuiltNode> level, upper;
+  PageId            pid;
+  BulkEntry         e;
+  string            leafKey;
+  bool              more;
+  int               fill = (int) (PageFile::PAGE_SIZE * BULK_FILL_FACTOR);
+
+  if (!bulkLoading)
+    return 0;
+  bulkLoading = false;
+
+  // the entries come sorted, with the same key kept in RecordId order.
+  // pack them into leaves, each pointing to the one written next
+  pid = max(pf.endPid(), 1);
+  more = ((rc = bulkEntries.next(e)) == 0);
+  while (more) {
+    int size = NODE_HEADER_SIZE;
+
+    node.keys.clear();
+    node.ptrs.clear();
+    while (more) {
+      leafKey.assign(e.key, e.length);
+      if (!node.keys.empty() && size + entrySize(leafKey, true) > fill)
+        break;
+      node.keys.push_back(leafKey);
+      node.ptrs.push_back(e.rid);
+      size += entrySize(leafKey, true);
+      more = ((rc = bulkEntries.next(e)) == 0);
+    }
+    if (rc < 0 && rc != RC_END_OF_FILE)
+      goto exit_bulk;
+
+    if ((rc = writeNode(pf, pid, true, node, 0, node.keys.size(), more ? pid + 1 : -1)) < 0)
+      goto exit_bulk;
+    BuiltNode built = { pid, node.keys.front(), node.keys.back() };
+    level.push_back(built);
+    pid++;
+  }
+  if (rc < 0 && rc != RC_END_OF_FILE)
+    goto exit_bulk;
+  rc = 0;
+  if (level.empty()) // nothing was loaded
+    goto exit_bulk;
+  treeHeight = 1;
+
+  // build each nonleaf level on top of the one below until one node is left
+  while (level.size() > 1) {
+    upper.clear();
+    for (unsigned i = 0; i < level.size(); ) {
+      BuiltNode built = { pid, level[i].first, level[i].last };
+      PageId    leftmost = level[i].pid;
+      int       size = NODE_HEADER_SIZE;
+
+      node.keys.clear();
+      node.ptrs.clear();
+      for (i++; i < level.size(); i++) {
+        string   key = separator(level[i - 1].last, level[i].first);
+        RecordId child = { level[i].pid, 0 };
+        int      entry = entrySize(key, false);
+        if (!node.keys.empty() && size + entry > fill) break;
+        node.keys.push_back(key);
+        node.ptrs.push_back(child);
+        built.last = level[i].last;
+        size += entry;
+      }
+
+      if ((rc = writeNode(pf, pid, false, node, 0, node.keys.size(), leftmost)) < 0)
+        goto exit_bulk;
+      upper.push_back(built);
+      pid++;
+    }
+    level.swap(upper);
+    treeHeight++;
+  }
+
+  rootPid = level[0].pid;
+  rc = writeMetadata();
+
+  exit_bulk:
+  bulkEntries.clear();
+  return rc;
+}
+
+StringScan::StringScan()
+: index(NULL), nextPid(-1), eid(0)
+{
+}
+
+RC StringScan::open(const StringIndex& tree, const string& searchKey)
+{
+  RC     rc;
+  PageId pid;
+
+  close();
+  index = &tree;
+
+  // an empty tree has no leaf to start from
+  if ((rc = index->findLeaf(searchKey, pid)) == RC_END_OF_TREE)
+    return 0;
+  if (rc < 0 || (rc = readLeaf(pid)) < 0)
+    return rc;
+
+  // the leftmost leaf that may hold searchKey can end before it
+  while ((eid = lower_bound(keys.begin(), keys.end(), searchKey) - keys.begin()) == keys.size() && nextPid > 0) {
+    if ((rc = readLeaf(nextPid)) < 0)
+      return rc;
+  }
+  return 0;
+}
+
+void StringScan::close()
+{
+  nextPid = -1;
+  eid = 0;
+  keys.clear();
+  rids.clear();
+}
+
+RC StringScan::readLeaf(PageId pid)
+{
+  RC      rc;
+  StrNode leaf;
+
+  if ((rc = readNode(index->pf, pid, true, leaf)) < 0) {
+    close();
+    return rc;
+  }
+  keys.swap(leaf.keys);
+  rids.swap(leaf.ptrs);
+  nextPid = leaf.link;
+  eid = 0;
+  return 0;
+}
+
+RC StringScan::next(string& key, RecordId& rid)
+{
+  RC rc;
+
+  if (index == NULL) return RC_INVALID_CURSOR;
+
+  // skip to the next leaf once the current one is exhausted
+  while (eid >= keys.size()) {
+    if (nextPid <= 0)
+      return RC_END_OF_TREE;
+    if ((rc = readLeaf(nextPid)) < 0)
+      return rc;
+  }
+
+  key = keys[eid];
+  rid = rids[eid];
+  eid++;
+  return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#ifndef STRINGINDEX_H
+#define STRINGINDEX_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "RecordFile.h"
+#include "ExternalSort.h"
+
+/**
+ * a B+tree index over the value column, mapping each value to the
+ * RecordIds of the tuples holding it. the same value may appear any
+ * number of times.
+ *
+ * keys are strings of up to MAX_KEY_LENGTH characters and are stored
+ * with their length, so a node holds as many entries as fit in its page.
+ * a longer value is indexed by its first MAX_KEY_LENGTH characters (see
+ * keyOf()), so the tuples found through a key of that length must be
+ * checked against the table. a leaf stores
+ * [count][next pid][(length, key, rid) ...] and a nonleaf node stores
+ * [count][leftmost pid][(length, key, pid) ...]. the key separating two
+ * nodes is cut down to the shortest prefix of the first key on its right
+ * that is still larger than the last key on its left, so the nonleaf
+ * nodes mostly hold a few characters per key.
+ *
+ * the index is not safe to use from several threads at a time.
+ */
+class StringIndex {
+ public:
+  // the longest key, as its length is stored in a byte
+  static const int MAX_KEY_LENGTH = 255;
+
+  // # entries sorted in memory by bulk loading before they are spilled
+  // to a temporary run file
+  static const int SORT_BUFFER_ENTRIES = 1 << 16;
+
+  /**
+   * the key a value is indexed by: the value itself, cut down to
+   * MAX_KEY_LENGTH characters. the keys keep the order of the values,
+   * but a key of MAX_KEY_LENGTH characters may stand for longer values.
+   * @param value[IN] the value
+   * @return the key of the value
+   */
+  static std::string keyOf(const std::string& value) { return value.substr(0, MAX_KEY_LENGTH); }
+
+  StringIndex();
+
+  /**
+   * open the index file in read or write mode.
+   * under 'w' mode, the index file is created if it does not exist.
+   * @param indexname[IN] the name of the index file
+   * @param mode[IN] 'r' for read, 'w' for write
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& indexname, char mode);
+
+  /**
+   * close the index file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * insert (keyOf(value), RecordId) pair to the index.
+   * @param value[IN] the value of the record
+   * @param rid[IN] the RecordId of the record
+   * @return error code. 0 if no error
+   */
+  RC insert(const std::string& value, const RecordId& rid);
+
+  /**
+   * start building an empty index bottom-up. the entries passed to
+   * bulkInsert() are sorted (with an external merge sort if they do not
+   * fit in memory) and packed into leaves by endBulkLoad(), and the
+   * nonleaf levels are then built on top of the leaves.
+   * @return error code. 0 if no error. RC_INVALID_FILE_FORMAT if
+   *         the index is not empty.
+   */
+  RC beginBulkLoad();
+
+  /**
+   * add a (keyOf(value), RecordId) pair to an index being bulk loaded.
+   * @param value[IN] the value of the record
+   * @param rid[IN] the RecordId of the record
+   * @return error code. 0 if no error
+   */
+  RC bulkInsert(const std::string& value, const RecordId& rid);
+
+  /**
+   * build the index from the entries passed to bulkInsert().
+   * @return error code. 0 if no error
+   */
+  RC endBulkLoad();
+
+ private:
+  friend class StringScan;
+
+  // find the leftmost leaf that may hold searchKey
+  RC findLeaf(const std::string& searchKey, PageId& pid) const;
+
+  // insert the entry into the subtree under pid, at the given level. if
+  // the node splits, the key and the PageId of the new sibling are
+  // returned in keyUp and newPid; otherwise newPid is -1
+  RC insertHelper(const std::string& key, const RecordId& rid, PageId pid, int level, std::string& keyUp, PageId& newPid);
+
+  // write rootPid and treeHeight to page 0
+  RC writeMetadata();
+
+  PageFile pf;         // the PageFile used to store the actual b+tree in disk
+  char     fileMode;   // the mode the index file was opened in
+  PageId   rootPid;    // the PageId of the root node (-1 if empty)
+  int      treeHeight; // the height of the tree. the leaves are at level treeHeight
+
+  // an entry being bulk loaded, ordered by key and then RecordId
+  struct BulkEntry {
+    RecordId      rid;
+    unsigned char length;               // # characters of the key
+    char          key[MAX_KEY_LENGTH];
+    bool operator< (const BulkEntry& e) const;
+  };
+
+  bool     bulkLoading; // true between begin/endBulkLoad()
+  ExternalSort<BulkEntry> bulkEntries; // the entries to load
+};
+
+/**
+ * a cursor for range scans over a StringIndex. the entries of the current
+ * leaf are copied at once, so every leaf is read only once.
+ */
+class StringScan {
+ public:
+  StringScan();
+
+  /**
+   * position the scan at the first entry whose key is searchKey or larger.
+   * @param index[IN] the index to scan. it must stay open during the scan
+   * @param searchKey[IN] the smallest key to return
+   * @return error code. 0 if no error
+   */
+  RC open(const StringIndex& index, const std::string& searchKey);
+
+  /**
+   * read the next (key, rid) pair and advance the scan.
+   * @param key[OUT] the key of the entry
+   * @param rid[OUT] the RecordId of the entry
+   * @return error code. 0 if no error. RC_END_OF_TREE if no entry is left
+   */
+  RC next(std::string& key, RecordId& rid);
+
+  /**
+   * finish the scan.
+   */
+  void close();
+
+ private:
+  // copy the entries of leaf pid
+  RC readLeaf(PageId pid);
+
+  const StringIndex*       index;   // the index being scanned
+  PageId                   nextPid; // the leaf after the current one (<= 0 if none)
+  unsigned                 eid;     // the next entry to return
+  std::vector<std::string> keys;    // the entries of
+  std::vector<RecordId>    rids;    //   the current leaf
+};
+
+#endif /* STRINGINDEX_H */
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#include "ValueDictionary.h"
+#include <cstring>
+
+using namespace std;
+
+ValueDictionary::ValueDictionary()
+: fileMode('r'), indexed(false), used(0), dirty(0)
+{
+  pthread_rwlock_init(&latch, NULL);
+}
+
+ValueDictionary::~ValueDictionary()
+{
+  pthread_rwlock_destroy(&latch);
+}
+
+RC ValueDictionary::open(const string& filename, char mode)
+{
+  RC rc;
+  if ((rc = pf.open(filename, mode)) < 0)
+    return rc;
+  fileMode = mode;
+
+  // the pages are read as they are needed
+  pages.assign(pf.endPid(), vector<string>());
+  loaded.assign(pf.endPid(), false);
+  codes.clear();
+  recent.clear();
+  indexed = false;
+  used = 0;
+  dirty = pf.endPid();
+  return 0;
+}
+
+RC ValueDictionary::close()
+{
+  RC rc = 0;
+
+  if (fileMode == 'w' || fileMode == 'W')
+    rc = flush();
+
+  pages.clear();
+  loaded.clear();
+  codes.clear();
+  vector<unsigned>().swap(recent);
+  indexed = false;
+
+  if (rc < 0) {
+    pf.close();
+    return rc;
+  }
+  return pf.close();
+}
+
+RC ValueDictionary::loadPage(PageId pid) const
+{
+  RC    rc;
+  char  page[PageFile::PAGE_SIZE];
+  int   count;
+  unsigned short length;
+
+  if (pid < 0 || pid >= (PageId) pages.size())
+    return RC_INVALID_RID;
+  if (loaded[pid])
+    return 0;
+
+  if ((rc = pf.read(pid, page)) < 0)
+    return rc;
+
+  // a page is [count][(length, value bytes) ...]
+  memcpy(&count, page, sizeof(int));
+  if (count < 0 || count > ENTRIES_PER_PAGE)
+    return RC_INVALID_FILE_FORMAT;
+
+  const char* p = page + sizeof(int);
+  pages[pid].resize(count);
+  for (int i = 0; i < count; i++) {
+    memcpy(&length, p, sizeof(length));
+    if (p + sizeof(length) + length > page + PageFile::PAGE_SIZE) {
+      pages[pid].clear();
+      return RC_INVALID_FILE_FORMAT;
+    }
+    pages[pid][i].assign(p + sizeof(length), length);
+    p += sizeof(length) + length;
+  }
+
+  loaded[pid] = true;
+  return 0;
+}
+
+RC ValueDictionary::loadAll()
+{
+  RC rc = 0;
+
+  if (indexed)
+    return 0;
+
+  pthread_rwlock_wrlock(&latch);
+  for (PageId pid = 0; pid < (PageId) pages.size() && rc == 0; pid++)
+    rc = loadPage(pid);
+  pthread_rwlock_unlock(&latch);
+  if (rc < 0)
+    return rc;
+
+  for (PageId pid = 0; pid < (PageId) pages.size(); pid++)
+    for (unsigned i = 0; i < pages[pid].size(); i++)
+      codes[pages[pid][i]] = pid * ENTRIES_PER_PAGE + i;
+
+  // new values go on after the values of the last page
+  used = sizeof(int);
+  if (!pages.empty()) {
+    const vector<string>& last = pages.back();
+    for (unsigned i = 0; i < last.size(); i++)
+      used += sizeof(unsigned short) + last[i].size();
+  }
+
+  indexed = true;
+  return 0;
+}
+
+bool ValueDictionary::find(const string& value, int& code)
+{
+  if (loadAll() < 0)
+    return false;
+
+  map<string, int>::const_iterator it = codes.find(value);
+  if (it == codes.end())
+    return false;
+  code = it->second;
+  return true;
+}
+
+bool ValueDictionary::repeats(const string& value)
+{
+  // FNV-1a hash of the value. 0 marks a slot holding no value
+  unsigned h = 2166136261u;
+  for (unsigned i = 0; i < value.size(); i++)
+    h = (h ^ (unsigned char) value[i]) * 16777619u;
+  if (h == 0) h = 1;
+
+  // a value is remembered in a slot picked by its hash, in place of
+  // the value met before it in the same slot
+  if (recent.empty())
+    recent.assign(RECENT_VALUES, 0);
+  unsigned& slot = recent[h % RECENT_VALUES];
+  if (slot == h)
+    return true;
+  slot = h;
+  return false;
+}
+
+RC ValueDictionary::add(const string& value, int& code)
+{
+  RC  rc;
+  int size = sizeof(unsigned short) + value.size();
+
+  if (sizeof(int) + size > (unsigned) PageFile::PAGE_SIZE)
+    return RC_INVALID_ATTRIBUTE;
+  if ((rc = loadAll()) < 0)
+    return rc;
+
+  pthread_rwlock_wrlock(&latch);
+
+  // start a new page once the last one is full
+  if (pages.empty() || (int) pages.back().size() >= ENTRIES_PER_PAGE ||
+      used + size > PageFile::PAGE_SIZE) {
+    if ((int) pages.size() >= MAX_PAGES) {
+      pthread_rwlock_unlock(&latch);
+      return RC_NODE_FULL;
+    }
+    pages.push_back(vector<string>());
+    loaded.push_back(true);
+    used = sizeof(int);
+  }
+
+  PageId pid = pages.size() - 1;
+  code = pid * ENTRIES_PER_PAGE + pages[pid].size();
+  pages[pid].push_back(value);
+  used += size;
+  if (pid < dirty) dirty = pid;
+
+  pthread_rwlock_unlock(&latch);
+
+  codes[value] = code;
+  return 0;
+}
+
+RC ValueDictionary::flush()
+{
+  RC   rc;
+  char page[PageFile::PAGE_SIZE];
+  unsigned short length;
+
+  for (PageId pid = dirty; pid < (PageId) pages.size(); pid++) {
+    int   count = pages[pid].size();
+    char* p = page + sizeof(int);
+
+    memset(page, 0, PageFile::PAGE_SIZE);
+    memcpy(page, &count, sizeof(int));
+    for (int i = 0; i < count; i++) {
+      length = pages[pid][i].size();
+      memcpy(p, &length, sizeof(length));
+      memcpy(p + sizeof(length), pages[pid][i].data(), length);
+      p += sizeof(length) + length;
+    }
+    if ((rc = pf.write(pid, page)) < 0)
+      return rc;
+  }
+
+  dirty = pages.size();
+  return 0;
+}
+
+RC ValueDictionary::lookup(int code, string& value) const
+{
+  RC     rc;
+  PageId pid = code / ENTRIES_PER_PAGE;
+  int    n = code % ENTRIES_PER_PAGE;
+
+  if (code < 0)
+    return RC_INVALID_RID;
+
+  // the pages read already are shared by the threads looking up values.
+  // a page not read yet is read under the write lock
+  pthread_rwlock_rdlock(&latch);
+  if (pid < (PageId) pages.size() && !loaded[pid]) {
+    pthread_rwlock_unlock(&latch);
+    pthread_rwlock_wrlock(&latch);
+  }
+  if ((rc = loadPage(pid)) == 0) {
+    if (n < (int) pages[pid].size())
+      value = pages[pid][n];
+    else
+      rc = RC_INVALID_RID;
+  }
+  pthread_rwlock_unlock(&latch);
+  return rc;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ *
+ * @author Junghoo "John" Cho <cho AT cs.ucla.edu>
+ * @date 3/24/2008
+ */
+
+#ifndef VALUEDICTIONARY_H
+#define VALUEDICTIONARY_H
+
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+/**
+ * the dictionary of the values of a table. a value stored more than once
+ * in a table is kept here once, and its later copies in the table pages
+ * are replaced by its code. a value is added once it repeats (see
+ * repeats()), and no more values are added once the dictionary has
+ * MAX_PAGES pages.
+ *
+ * every page of the dictionary holds [count][(length, value bytes) ...].
+ * the code of a value is its page number times ENTRIES_PER_PAGE plus its
+ * position in the page, so a value is found by reading a single page, and
+ * a code never changes once given out.
+ *
+ * the pages are read when a code in them is first looked up and are then
+ * kept in memory until close(). lookup() is safe to call from several
+ * threads at a time.
+ */
+class ValueDictionary {
+ public:
+  // # values in a dictionary page at most
+  static const int ENTRIES_PER_PAGE = 256;
+
+  // # pages of a dictionary at most
+  static const int MAX_PAGES = 256;
+
+  // # values met once that are remembered until they repeat
+  static const int RECENT_VALUES = 1 << 16;
+
+  ValueDictionary();
+  ~ValueDictionary();
+
+  /**
+   * open the dictionary file in read or write mode.
+   * under 'w' mode, the dictionary file is created if it does not exist.
+   * @param filename[IN] the name of the dictionary file
+   * @param mode[IN] 'r' for read, 'w' for write
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& filename, char mode);
+
+  /**
+   * close the dictionary file, writing the values added since the last
+   * flush().
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * find the code of a value. 'w' mode only.
+   * @param value[IN] the value to look for
+   * @param code[OUT] the code of the value
+   * @return true if the value is in the dictionary
+   */
+  bool find(const std::string& value, int& code);
+
+  /**
+   * tell whether a value not in the dictionary has been met before, and
+   * remember it otherwise. only the last RECENT_VALUES values met are
+   * remembered, by a hash of each, so a value met long ago is taken as
+   * new and, rarely, a new value is taken as met. 'w' mode only.
+   * @param value[IN] the value met
+   * @return true if the value has been met before
+   */
+  bool repeats(const std::string& value);
+
+  /**
+   * add a value to the dictionary. 'w' mode only.
+   * the value is written to the file by the next flush().
+   * @param value[IN] the value to add. it must fit in a page by itself
+   * @param code[OUT] the code given to the value
+   * @return error code. 0 if no error. RC_NODE_FULL if the dictionary
+   *         has MAX_PAGES pages and the last one is full
+   */
+  RC add(const std::string& value, int& code);
+
+  /**
+   * write the values added since the last flush() to the file.
+   * @return error code. 0 if no error
+   */
+  RC flush();
+
+  /**
+   * find the value of a code.
+   * @param code[IN] the code of the value
+   * @param value[OUT] the value
+   * @return error code. 0 if no error. RC_INVALID_RID if there is no
+   *         value of the code
+   */
+  RC lookup(int code, std::string& value) const;
+
+ private:
+  ValueDictionary(const ValueDictionary&);            // not copyable
+  ValueDictionary& operator=(const ValueDictionary&);
+
+  // read the values of the page pid unless they have been read already.
+  // the caller holds latch for writing, or for reading if the page has
+  // been read
+  RC loadPage(PageId pid) const;
+
+  // read all pages and index their values in codes unless it is done
+  RC loadAll();
+
+  PageFile pf;       // the PageFile used to store the dictionary
+  char     fileMode; // the mode the dictionary file was opened in
+
+  mutable std::vector<std::vector<std::string> > pages; // values by page
+  mutable std::vector<bool> loaded;     // true for the pages read
+  mutable pthread_rwlock_t  latch;      // guards pages and loaded
+
+  std::map<std::string, int> codes;     // the code of every value in 'w' mode
+  std::vector<unsigned> recent;         // the hashes of the values met once
+  bool     indexed;   // true once codes holds all values
+  int      used;      // # bytes used in the last page
+  PageId   dirty;     // the first page changed since the last flush
+};
+
+#endif /* VALUEDICTIONARY_H */
@@ -9,10 +9,30 @@
  
 #include "Bruinbase.h"
 #include "SqlEngine.h"
+#include "PageFile.h"
 #include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
 
-int main()
+int main(int argc, char* argv[])
 {
+  int c;
+
+  // -c <pages>: the number of page frames in the buffer pool
+  while ((c = getopt(argc, argv, "c:")) != -1) {
+    switch (c) {
+    case 'c':
+      if (PageFile::setCacheSize(atoi(optarg)) < 0) {
+        fprintf(stderr, "Error: invalid buffer pool size %s\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-c cache_pages]\n", argv[0]);
+      return 1;
+    }
+  }
+
   // run the SQL engine taking user commands from standard input (console).
   SqlEngine::run(stdin);
 